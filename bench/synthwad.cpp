@@ -0,0 +1,137 @@
+// SYNTHWAD_CPP
+
+#include "synthwad.h"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+static const char* MAP_LUMPS[10] = {
+    "THINGS", "LINEDEFS", "SIDEDEFS", "VERTEXES", "SEGS", "SSECTORS", "NODES", "SECTORS", "REJECT", "BLOCKMAP"
+};
+
+// Streams lump data to the file and collects the descriptors, which are written last
+struct SynthWriter {
+    FILE* out;
+    vector<char> descriptors;
+    vector<string>* paths;
+    uint64_t offset = 12;
+    mt19937 rng;
+    SizeDistribution distribution;
+    uniform_int_distribution<uint32_t> uniformSizes;
+    uniform_real_distribution<double> logSizes;
+    vector<char> pattern;
+    uint32_t nextLump = 0;
+    bool ok = true;
+
+    void descriptor(uint32_t lumpOffset, uint32_t size, const string &name) {
+        char entry[16] = {0};
+        memcpy(entry, &lumpOffset, 4);
+        memcpy(entry + 4, &size, 4);
+        memcpy(entry + 8, name.data(), min<size_t>(name.size(), 8));
+        descriptors.insert(descriptors.end(), entry, entry + 16);
+    }
+
+    uint32_t nextSize() {
+        switch (distribution) {
+        case SizeDistribution::Fixed:
+            return uniformSizes.max();
+        case SizeDistribution::LogUniform:
+            return clamp(static_cast<uint32_t>(exp(logSizes(rng))), uniformSizes.min(), uniformSizes.max());
+        default:
+            return uniformSizes(rng);
+        }
+    }
+
+    void lump(const string &dir, const string &name) {
+        uint32_t size = nextSize();
+        if (offset + size > UINT32_MAX) {
+            ok = false;
+            return;
+        }
+        // Cycle through the pattern from a per-lump start so neighbouring lumps differ
+        size_t start = (static_cast<size_t>(nextLump) * 61) % pattern.size();
+        for (uint32_t done = 0; done < size; ) {
+            size_t chunk = min<size_t>(size - done, pattern.size() - start);
+            ok = ok && fwrite(pattern.data() + start, 1, chunk, out) == chunk;
+            done += chunk;
+            start = 0;
+        }
+        descriptor(offset, size, name);
+        if (paths)
+            paths->push_back(dir + "/" + name);
+        offset += size;
+        ++nextLump;
+    }
+};
+
+// Two-character namespace name for index i (base 36)
+static string namespaceName(int i) {
+    static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    return string(1, digits[(i / 36) % 36]) + digits[i % 36];
+}
+
+static void writeNamespace(SynthWriter &w, const SynthSpec &spec, const string &dir, int level,
+                           uint32_t first, uint32_t count) {
+    if (level == spec.depth) {
+        for (uint32_t i = 0; i < count && w.ok; ++i)
+            w.lump(dir, "L" + to_string(first + i));
+        return;
+    }
+
+    // Split this namespace's lumps evenly over its children, remainder to the first ones
+    uint32_t share = count / spec.fanout, extra = count % spec.fanout;
+    for (int child = 0; child < spec.fanout && w.ok; ++child) {
+        string name = namespaceName(child);
+        uint32_t childCount = share + (static_cast<uint32_t>(child) < extra ? 1 : 0);
+        w.descriptor(w.offset, 0, name + "_START");
+        writeNamespace(w, spec, dir + "/" + name, level + 1, first, childCount);
+        w.descriptor(w.offset, 0, name + "_END");
+        first += childCount;
+    }
+}
+
+bool writeSynthWad(const string &path, const SynthSpec &spec, vector<string> *paths) {
+    if (spec.fanout < 1 || spec.fanout > 36 * 36 || spec.depth < 0 || spec.maps < 0 || spec.maps > 81 ||
+        spec.minSize > spec.maxSize)
+        return false;
+
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out)
+        return false;
+    static char streamBuffer[1 << 20];
+    setvbuf(out, streamBuffer, _IOFBF, sizeof(streamBuffer));
+
+    SynthWriter w;
+    w.out = out;
+    w.paths = paths;
+    w.rng.seed(spec.seed);
+    w.distribution = spec.sizes;
+    w.uniformSizes = uniform_int_distribution<uint32_t>(spec.minSize, spec.maxSize);
+    w.logSizes = uniform_real_distribution<double>(log(max(spec.minSize, 1u)), log(spec.maxSize + 1.0));
+    w.pattern.resize(64 * 1024);
+    for (size_t i = 0; i < w.pattern.size(); ++i)
+        w.pattern[i] = static_cast<char>('a' + i % 26);
+    w.descriptors.reserve((static_cast<size_t>(spec.lumps) + spec.maps * 11) * 16);
+
+    // Header placeholder; the count and table offset are known at the end
+    w.ok = fwrite(spec.iwad ? "IWAD\0\0\0\0\0\0\0\0" : "PWAD\0\0\0\0\0\0\0\0", 1, 12, out) == 12;
+
+    for (int m = 0; m < spec.maps && w.ok; ++m) {
+        string map = "E" + to_string(1 + m / 9) + "M" + to_string(1 + m % 9);
+        w.descriptor(0, 0, map);
+        for (const char* name : MAP_LUMPS)
+            w.lump("/" + map, name);
+    }
+    writeNamespace(w, spec, "", 0, 0, spec.lumps);
+
+    uint32_t count = w.descriptors.size() / 16;
+    uint32_t tableOffset = w.offset;
+    bool ok = w.ok && w.offset + w.descriptors.size() <= UINT32_MAX &&
+              fwrite(w.descriptors.data(), 1, w.descriptors.size(), out) == w.descriptors.size() &&
+              fseek(out, 4, SEEK_SET) == 0 &&
+              fwrite(&count, 4, 1, out) == 1 && fwrite(&tableOffset, 4, 1, out) == 1;
+    return fclose(out) == 0 && ok;
+}
@@ -0,0 +1,33 @@
+// SYNTHWAD_H
+
+// Synthetic WAD archives for the benchmarks and the wadgen tool: any number of lumps spread over a 
+// tree of nested namespaces, plus a run of ExMy map blocks at the root. Lump data is streamed straight 
+// to disk; only the 16-byte descriptors are held in memory until the table is written.
+
+#include <string>
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+// How lump sizes are drawn from [minSize, maxSize]
+enum class SizeDistribution {
+    Uniform,        // Every size equally likely
+    LogUniform,     // Every order of magnitude equally likely: mostly small lumps, a few large ones
+    Fixed           // Always maxSize
+};
+
+struct SynthSpec {
+    uint32_t lumps = 1000;      // Regular lumps, spread evenly over the leaf namespaces
+    int depth = 2;              // Levels of namespace nesting below the root (0 puts every lump in the root)
+    int fanout = 4;             // Namespaces per level (at most 36 * 36, names are two characters)
+    int maps = 0;               // ExMy map blocks of 10 lumps each at the root (at most 81)
+    uint32_t minSize = 16;      // Lump sizes fall in [minSize, maxSize]
+    uint32_t maxSize = 256;
+    SizeDistribution sizes = SizeDistribution::Uniform;
+    bool iwad = false;          // Magic is IWAD instead of PWAD
+    uint32_t seed = 1;
+};
+
+// Writes the archive to path. If paths is given, it receives the absolute path of every lump in
+// descriptor order (map lumps included). Returns false if the file could not be written.
+bool writeSynthWad(const string &path, const SynthSpec &spec, vector<string> *paths = nullptr);
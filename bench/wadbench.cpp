@@ -0,0 +1,197 @@
+// WADBENCH_CPP
+
+// Startup and lookup benchmarks for libWad over synthetic archives.
+// Usage: ./wadbench [--large] [workdir]
+// Every scenario runs at 1k, 10k and 100k lumps (and 1M with --large). Archives are generated into
+// workdir (default /tmp) and deleted afterwards. Each line reports the best of several runs, so
+// numbers are comparable from one build to the next on the same machine.
+
+#include "synthwad.h"
+#include "../libWad/Wad.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <filesystem>
+#include <unistd.h>
+using namespace std;
+
+static const int RUNS = 5;
+
+// Best wall time of RUNS calls to f, in seconds
+static double bestOf(const function<void()> &f, int runs = RUNS) {
+    double best = 1e30;
+    for (int i = 0; i < runs; ++i) {
+        auto start = chrono::steady_clock::now();
+        f();
+        best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+static void report(const string &name, uint32_t lumps, size_t ops, double seconds, uint64_t bytes = 0) {
+    printf("%-28s %8u lumps %10zu ops %12.1f ns/op %14.0f ops/s", name.c_str(), lumps, ops,
+           seconds * 1e9 / max<size_t>(ops, 1), ops / seconds);
+    if (bytes)
+        printf(" %10.1f MB/s", bytes / seconds / 1e6);
+    printf("\n");
+}
+
+// Keeps results alive so the optimizer cannot drop the calls being timed
+static volatile long sink;
+
+static void benchArchive(const string &workdir, uint32_t lumps) {
+    SynthSpec spec;
+    spec.lumps = lumps;
+    spec.depth = 3;
+    spec.fanout = 6;
+    spec.maps = 27;
+
+    string wadPath = workdir + "/wadbench_" + to_string(lumps) + ".wad";
+    string indexPath = wadPath + ".idx";
+    vector<string> paths;
+    auto start = chrono::steady_clock::now();
+    if (!writeSynthWad(wadPath, spec, &paths)) {
+        fprintf(stderr, "Could not write %s\n", wadPath.c_str());
+        return;
+    }
+    report("generate", lumps, 1, chrono::duration<double>(chrono::steady_clock::now() - start).count(),
+           filesystem::file_size(wadPath));
+
+    // Startup in each load mode
+    WadOptions buffered, lazy, cached;
+    buffered.useMmap = false;
+    lazy.lazyTree = true;
+    cached.indexCachePath = indexPath;
+    report("loadWad mmap", lumps, 1, bestOf([&] { delete Wad::loadWad(wadPath); }));
+    report("loadWad pread", lumps, 1, bestOf([&] { delete Wad::loadWad(wadPath, buffered); }));
+    report("loadWad lazy", lumps, 1, bestOf([&] { delete Wad::loadWad(wadPath, lazy); }));
+    delete Wad::loadWad(wadPath, cached);
+    report("loadWad index cache", lumps, 1, bestOf([&] { delete Wad::loadWad(wadPath, cached); }));
+    unlink(indexPath.c_str());
+
+    Wad* wad = Wad::loadWad(wadPath);
+
+    // Lookups in random order, so the path table is not walked in insertion order
+    vector<string> shuffled = paths;
+    shuffle(shuffled.begin(), shuffled.end(), mt19937(spec.seed));
+    report("isContent", lumps, shuffled.size(), bestOf([&] {
+        long found = 0;
+        for (const string& path : shuffled)
+            found += wad->isContent(path);
+        sink = found;
+    }));
+    report("getSize", lumps, shuffled.size(), bestOf([&] {
+        long total = 0;
+        for (const string& path : shuffled)
+            total += wad->getSize(path);
+        sink = total;
+    }));
+
+    vector<WadHandle> handles;
+    for (const string& path : shuffled)
+        handles.push_back(wad->resolve(path));
+    report("getSize (handle)", lumps, handles.size(), bestOf([&] {
+        long total = 0;
+        for (WadHandle handle : handles)
+            total += wad->getSize(handle);
+        sink = total;
+    }));
+
+    // Every directory once
+    vector<string> dirs = {"/"};
+    for (const string& path : paths) {
+        for (size_t slash = path.find('/', 1); slash != string::npos; slash = path.find('/', slash + 1))
+            dirs.push_back(path.substr(0, slash));
+    }
+    sort(dirs.begin(), dirs.end());
+    dirs.erase(unique(dirs.begin(), dirs.end()), dirs.end());
+    report("getDirectory", lumps, dirs.size(), bestOf([&] {
+        long entries = 0;
+        for (const string& dir : dirs) {
+            vector<string> listing;
+            entries += wad->getDirectory(dir, &listing);
+        }
+        sink = entries;
+    }));
+
+    // Whole-archive read throughput through the handle API
+    vector<char> buffer(spec.maxSize);
+    uint64_t bytes = 0;
+    for (WadHandle handle : handles)
+        bytes += wad->getSize(handle);
+    report("getContents", lumps, handles.size(), bestOf([&] {
+        long copied = 0;
+        for (WadHandle handle : handles)
+            copied += wad->getContents(handle, buffer.data(), buffer.size());
+        sink = copied;
+    }), bytes);
+    delete wad;
+
+    // The same reads without a mapping, straight to pread and then through a lump cache that holds the archive
+    wad = Wad::loadWad(wadPath, buffered);
+    report("getContents pread", lumps, handles.size(), bestOf([&] {
+        long copied = 0;
+        for (WadHandle handle : handles)
+            copied += wad->getContents(handle, buffer.data(), buffer.size());
+        sink = copied;
+    }), bytes);
+    delete wad;
+    WadOptions lumpCache = buffered;
+    lumpCache.lumpCacheBytes = filesystem::file_size(wadPath) * 2;
+    wad = Wad::loadWad(wadPath, lumpCache);
+    report("getContents lump cache", lumps, handles.size(), bestOf([&] {
+        long copied = 0;
+        for (WadHandle handle : handles)
+            copied += wad->getContents(handle, buffer.data(), buffer.size());
+        sink = copied;
+    }), bytes);
+    delete wad;
+
+    // Edits: one batch of creates and writes, and a short run of individually committed ones
+    uint32_t edits = min<uint32_t>(lumps, 10000);
+    const char data[64] = "benchmark lump";
+    wad = Wad::loadWad(wadPath);
+    report("create+write (batch)", lumps, edits, bestOf([&] {
+        wad->beginBatch();
+        wad->createDirectory("/BB");
+        for (uint32_t i = 0; i < edits; ++i) {
+            string name = "/BB/W" + to_string(i);
+            wad->createFile(name);
+            wad->writeToFile(name, data, sizeof(data));
+        }
+        wad->commit();
+    }, 1));
+    uint32_t single = min<uint32_t>(edits, 100);
+    report("create+write (each)", lumps, single, bestOf([&] {
+        wad->createDirectory("/BE");
+        for (uint32_t i = 0; i < single; ++i) {
+            string name = "/BE/W" + to_string(i);
+            wad->createFile(name);
+            wad->writeToFile(name, data, sizeof(data));
+        }
+    }, 1));
+    delete wad;
+
+    unlink(wadPath.c_str());
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    bool large = false;
+    string workdir = "/tmp";
+    for (int i = 1; i < argc; ++i) {
+        if (string(argv[i]) == "--large")
+            large = true;
+        else
+            workdir = argv[i];
+    }
+
+    vector<uint32_t> sizes = {1000, 10000, 100000};
+    if (large)
+        sizes.push_back(1000000);
+    for (uint32_t lumps : sizes)
+        benchArchive(workdir, lumps);
+    return 0;
+}
@@ -1,37 +1,263 @@
 // WAD_CPP
 
 #include "Wad.h"
+#include "WadLog.h"
 #include <stack>
-#include <fstream>
 #include <cstring>
 #include <algorithm>
+#include <mutex>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 using namespace std;
 
-// Helper function that takes in a WadNode pointer (typically root
+// Helper function that takes in a node index (typically root
 // but determined by depth) and prints all nodes and their parents below
-void Wad::printTree(WadNode* node, int depth = 0) {
-    if (!node) 
+void Wad::printTree(uint32_t index, int depth = 0) {
+    if (index >= nodes.size()) 
         return;
 
+    const WadNode& node = nodes[index];
+
     // Indentation based on depth
     for (int i = 0; i < depth; ++i)
         cout << "--|";
 
     // Display type
-    string type = node->isDirectory ? (node->isMap ? "[MapDir] " : "[Dir] ") : "[File] ";
+    string type = node.isDirectory ? (node.isMap ? "[MapDir] " : "[Dir] ") : "[File] ";
 
-    cout << type << node->name << " (FullPath: " << node->fullPath << ")\n";
+    cout << type << node.getName() << " (FullPath: " << nodePath(index) << ")\n";
 
     // Recurse on children
-    for (WadNode* child : node->children) {
+    for (uint32_t child = node.firstChild; child != NO_NODE; child = nodes[child].nextSibling) {
         printTree(child, depth + 1);
     }
 }
 
+// Appends node to the arena, links it in as the last child of parent and indexes its path
+uint32_t Wad::addNode(const WadNode &node, uint32_t parent) {
+    uint32_t index = nodes.size();
+    nodes.push_back(node);
+    linkChildAfter(parent, nodes[parent].lastChild, index);
+    indexChild(index);
+    return index;
+}
+
+// Splices child into parent's singly linked child list after prev
+void Wad::linkChildAfter(uint32_t parent, uint32_t prev, uint32_t child) {
+    WadNode& p = nodes[parent];
+    nodes[child].parent = parent;
+
+    if (prev == NO_NODE) {
+        nodes[child].nextSibling = p.firstChild;
+        p.firstChild = child;
+    } else {
+        nodes[child].nextSibling = nodes[prev].nextSibling;
+        nodes[prev].nextSibling = child;
+    }
+
+    if (nodes[child].nextSibling == NO_NODE)
+        p.lastChild = child;
+}
+
+// Packs an 8-byte lump name into one integer so keys compare and hash in a single step
+static uint64_t nameKey(string_view name) {
+    uint64_t key = 0;
+    memcpy(&key, name.data(), min(name.size(), sizeof(key)));
+    return key;
+}
+
+static size_t childHash(uint32_t parent, uint64_t key) {
+    uint64_t h = (key ^ (static_cast<uint64_t>(parent) << 32 | parent)) * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(h ^ (h >> 29));
+}
+
+size_t Wad::childSlot(uint32_t parent, string_view name) const {
+    uint64_t key = nameKey(name);
+    size_t mask = childTable.size() - 1;
+    size_t slot = childHash(parent, key) & mask;
+
+    while (childTable[slot] != NO_NODE) {
+        const WadNode& node = nodes[childTable[slot]];
+        if (node.parent == parent && nameKey(string_view(node.name, sizeof(node.name))) == key)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void Wad::indexChild(uint32_t index) {
+    // Keep the table at most half full
+    if ((childCount + 1) * 2 > childTable.size()) {
+        vector<uint32_t> old = move(childTable);
+        childTable.assign(max<size_t>(16, old.size() * 2), NO_NODE);
+        for (uint32_t child : old) {
+            if (child != NO_NODE)
+                childTable[childSlot(nodes[child].parent, nodes[child].getName())] = child;
+        }
+    }
+
+    size_t slot = childSlot(nodes[index].parent, nodes[index].getName());
+    if (childTable[slot] == NO_NODE)
+        ++childCount;
+    childTable[slot] = index;
+}
+
+// Removes index from childTable. Later entries of its probe run move back over the hole, so a
+// lookup never stops at it short of an entry that probed past it.
+void Wad::unindexChild(uint32_t index) {
+    size_t mask = childTable.size() - 1;
+    size_t slot = childSlot(nodes[index].parent, nodes[index].getName());
+    if (childTable[slot] != index)
+        return;
+    childTable[slot] = NO_NODE;
+    --childCount;
+
+    for (size_t next = (slot + 1) & mask; childTable[next] != NO_NODE; next = (next + 1) & mask) {
+        const WadNode& node = nodes[childTable[next]];
+        size_t home = childHash(node.parent, nameKey(node.getName())) & mask;
+        // Stays put only if its home lies after the hole, between it and its slot
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            childTable[slot] = childTable[next];
+            childTable[next] = NO_NODE;
+            slot = next;
+        }
+    }
+}
+
+// Takes back an addNode: unlinks the node from its parent and the path table. The arena slot is
+// reclaimed when it is still the last one, else the node is left behind unreachable.
+void Wad::removeNode(uint32_t index) {
+    uint32_t parent = nodes[index].parent;
+    unindexChild(index);
+
+    WadNode& p = nodes[parent];
+    uint32_t prev = NO_NODE;
+    for (uint32_t child = p.firstChild; child != index; child = nodes[child].nextSibling)
+        prev = child;
+    if (prev == NO_NODE)
+        p.firstChild = nodes[index].nextSibling;
+    else
+        nodes[prev].nextSibling = nodes[index].nextSibling;
+    if (p.lastChild == index)
+        p.lastChild = prev;
+
+    if (index + 1 == nodes.size())
+        nodes.pop_back();
+    else
+        nodes[index] = WadNode();
+}
+
+uint32_t Wad::findChild(uint32_t parent, string_view name) const {
+    if (childTable.empty() || name.empty() || name.size() > sizeof(WadNode::name))
+        return NO_NODE;
+    return childTable[childSlot(parent, name)];
+}
+
+// Walks the path one component at a time, skipping empty components; no strings are built
+uint32_t Wad::resolvePath(string_view path, uint32_t *reached) const {
+    if (nodes.empty() || path.empty() || path[0] != '/')
+        return NO_NODE;
+
+    uint32_t current = root;
+    size_t pos = 0;
+    while (current != NO_NODE) {
+        pos = path.find_first_not_of('/', pos);
+        if (pos == string_view::npos)
+            break;
+        size_t slash = path.find('/', pos);
+        if (reached)
+            *reached = current;
+        current = findChild(current, path.substr(pos, slash - pos));
+        pos = slash;
+    }
+    return current;
+}
+
+bool Wad::resolveParent(string_view path, uint32_t *parent, string_view *name) const {
+    size_t end = path.find_last_not_of('/');
+    if (path.empty() || path[0] != '/' || end == string_view::npos)
+        return false;
+
+    size_t slash = path.find_last_of('/', end);
+    *name = path.substr(slash + 1, end - slash);
+    *parent = resolvePath(path.substr(0, slash + 1));
+    return *parent != NO_NODE;
+}
+
+bool Wad::isContentNode(uint32_t index) const {
+    return index < nodes.size() && !nodes[index].isDirectory && !nodes[index].isMap;
+}
+
+// Walks parent links up to the root; paths are not stored per node
+string Wad::nodePath(uint32_t index) const {
+    if (index == root)
+        return "/";
+
+    string path;
+    for (uint32_t i = index; i != root; i = nodes[i].parent) {
+        string_view name = nodes[i].getName();
+        path.insert(0, name.data(), name.size());
+        path.insert(0, 1, '/');
+    }
+    return path;
+}
+
+// Sidecar index layout: this header, then the node arena, then childTable, all in native byte order.
+// The WAD's size, mtime, inode and a hash of its header identify the file the index was built from;
+// nodeSize and the version reject an index written by an incompatible build.
+struct IndexCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeSize;
+    uint64_t wadSize;
+    int64_t wadMtimeSec;
+    int64_t wadMtimeNsec;
+    uint64_t wadInode;
+    uint64_t wadHeaderHash;
+    uint64_t nodeCount;
+    uint64_t childTableSize;
+    uint64_t childCount;
+};
+
+static_assert(is_trivially_copyable_v<WadNode>, "the index cache stores WadNode bytes as they are");
+
+static const char INDEX_MAGIC[8] = {'W', 'A', 'D', 'I', 'N', 'D', 'E', 'X'};
+// The index stores the tree as built, not the descriptors: any change to how descriptors become
+// nodes (buildChildren, map and namespace detection) must bump this, or old indexes serve old trees.
+// 2: MAPxx markers and variable-length map blocks
+static const uint32_t INDEX_VERSION = 2;
+
+// FNV-1a over the WAD's 12-byte header; a rewritten table changes its count or offset
+static uint64_t hashWadHeader(const char *header) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (int i = 0; i < 12; ++i)
+        h = (h ^ static_cast<unsigned char>(header[i])) * 0x100000001B3ull;
+    return h;
+}
+
+static IndexCacheHeader indexKey(const struct stat &wadStat, const char *wadHeader) {
+    IndexCacheHeader key = {};
+    memcpy(key.magic, INDEX_MAGIC, sizeof(key.magic));
+    key.version = INDEX_VERSION;
+    key.nodeSize = sizeof(WadNode);
+    key.wadSize = wadStat.st_size;
+    key.wadMtimeSec = wadStat.st_mtim.tv_sec;
+    key.wadMtimeNsec = wadStat.st_mtim.tv_nsec;
+    key.wadInode = wadStat.st_ino;
+    key.wadHeaderHash = hashWadHeader(wadHeader);
+    return key;
+}
+
 // private Wad constructor, takes in path to a .WAD file from your real filesystem
 // Init a fstream object and store as a mbm var. Use to read hdr data
 // and construct the n-ary tree. No lump data needed.
-Wad::Wad(const string &path) {
+Wad::Wad(const string &path, const WadOptions &options) {
     /* 
     - << path from real filesystem
     - Init _myf = fstream(object)
@@ -39,119 +265,521 @@ Wad::Wad(const string &path) {
     - No lumps
     */
    wadFilePath = path;
-   fstream file;
-   file.open(path, ios::in | ios::out | ios::binary);
-   if (!file) {
-       cerr << "Failed to open WAD file: " << path << endl;
-       root = nullptr;
+
+   // One descriptor for the Wad's lifetime. Read-only media, read-only files and
+   // WadOptions::readOnly all give a read-only Wad instead of a failed load.
+   _readOnly = options.readOnly;
+   if (!_readOnly) {
+       _fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+       if (_fd < 0 && (errno == EACCES || errno == EROFS || errno == EPERM))
+           _readOnly = true;
+   }
+   if (_readOnly)
+       _fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if (_fd < 0) {
+       WAD_LOG_ERROR("Failed to open WAD file: " << path);
        return;
    }
 
    // Read WAD Header
-   char magic[5] = {0};
-   magic[4] = '\0';
+   char header[12] = {0};
    uint32_t lumpCount = 0, descriptorOffset = 0;
 
-   file.read(magic, 4);
-   file.read(reinterpret_cast<char*>(&lumpCount), 4);
-   file.read(reinterpret_cast<char*>(&descriptorOffset), 4);
+   if (readAt(header, sizeof(header), 0) != sizeof(header)) {
+       WAD_LOG_ERROR("Failed to read WAD header: " << path);
+       return;
+   }
+   memcpy(&lumpCount, header + 4, 4);
+   memcpy(&descriptorOffset, header + 8, 4);
+   char* magic = header;
+
+   // The header can claim any lump count; only descriptors the file actually holds are read, so a
+   // damaged count cannot size the arena, the path table or the descriptor buffer
+   struct stat wadStat;
+   bool haveStat = fstat(_fd, &wadStat) == 0;
+   uint64_t fileSize = haveStat ? wadStat.st_size : 0;
+   lumpCount = min<uint64_t>(lumpCount, fileSize > descriptorOffset ? (fileSize - descriptorOffset) / 16 : 0);
 
    // Save magic string & init mbr vars
    _magicString = string(magic, 4);
    _content = lumpCount;
    _offset = descriptorOffset;
+   _tableCapacity = lumpCount * 16;
+
+   _useMmap = options.useMmap;
+   if (_useMmap)
+       mapArchive();
+   _cacheBudget = options.lumpCacheBytes;
+   cacheStats.budget = _cacheBudget;
 
-   // init Root
-   root = new WadNode("/", true);
-   root->fullPath = "/";
-   pathMap["/"] = root;
-
-   // Read Descriptors
-   file.seekg(descriptorOffset, ios::beg);
-
-   struct LumpDesc {
-       int offset;
-       int size;
-       char name[9];  
-       // remember: name is null-terminated
-   };
-
-   vector<LumpDesc> descriptors;
-
-   for (uint32_t i = 0; i < lumpCount; ++i) {
-       LumpDesc desc;
-       file.read(reinterpret_cast<char*>(&desc.offset), 4);
-       file.read(reinterpret_cast<char*>(&desc.size), 4);
-       file.read(desc.name, 8);
-       desc.name[8] = '\0';
-       descriptors.push_back(desc);
+   // A sidecar index that matches this exact file replaces parsing the descriptor table
+   bool cacheable = !options.indexCachePath.empty() && haveStat;
+   if (cacheable && loadIndexCache(options.indexCachePath, indexKey(wadStat, header)))
+       return;
+
+   // init Root. A lazy tree starts from just the root and grows its arena and childTable on demand.
+   _lazy = options.lazyTree;
+   nodes.push_back(WadNode("/", true));
+   size_t slots = 16;
+   if (!_lazy) {
+       nodes.reserve(static_cast<size_t>(lumpCount) + 1);
+       while (slots < (static_cast<size_t>(lumpCount) + 1) * 2)
+           slots *= 2;
+   }
+   childTable.assign(slots, NO_NODE);
+
+   // Read Descriptors: the whole directory is _content * 16 bytes, fetched in one go
+   // (straight from the mapping when there is one) and decoded from that buffer
+   const uint64_t tableSize = static_cast<uint64_t>(lumpCount) * 16;
+
+   if (_mapped && descriptorOffset + tableSize <= _mappedSize) {
+       descriptorTable = _mapped + descriptorOffset;
+   } else {
+       descriptorBuffer.resize(tableSize);
+       int64_t got = readAt(descriptorBuffer.data(), tableSize, descriptorOffset);
+       // A truncated archive only yields the descriptors that were fully read
+       lumpCount = got > 0 ? got / 16 : 0;
+       descriptorTable = descriptorBuffer.data();
    }
 
-   // Decorate Tree
-   stack<WadNode*> dirStack;
-   dirStack.push(root);
-
-   for (size_t i = 0; i < descriptors.size(); ++i) {
-       LumpDesc& d = descriptors[i];
-       string name(d.name);
-
-       // START marker
-       if (name.size() > 6 && name.substr(name.size() - 6) == "_START") {
-           string ns = name.substr(0, name.size() - 6);
-           WadNode* dir = new WadNode(ns, true, false);
-           dir->parent = dirStack.top();
-           dir->fullPath = dirStack.top()->fullPath + (dirStack.top()->fullPath == "/" ? "" : "/") + ns;
-           dirStack.top()->children.push_back(dir);
-           pathMap[dir->fullPath] = dir;
-           dirStack.push(dir);
-       }
-       // END marker
-       else if (name.size() > 4 && name.substr(name.size() - 4) == "_END") {
-           if (!dirStack.empty()) dirStack.pop();
-       }
-       // Map marker
-       else if (name.size() == 4 && name[0] == 'E' && isdigit(name[1]) && name[2] == 'M' && isdigit(name[3])) {
-           WadNode* mapDir = new WadNode(name, true, true);
-           mapDir->parent = dirStack.top();
-           mapDir->fullPath = dirStack.top()->fullPath + (dirStack.top()->fullPath == "/" ? "" : "/") + name;
-           dirStack.top()->children.push_back(mapDir);
-           pathMap[mapDir->fullPath] = mapDir;
-
-
-           for (size_t j = 1; j <= 10 && (i + j) < descriptors.size(); ++j) {
-               LumpDesc& lump = descriptors[i + j];
-               WadNode* file = new WadNode(lump.name, false);
-               file->offset = lump.offset;
-               file->size = lump.size;
-               file->parent = mapDir;
-               file->fullPath = mapDir->fullPath + "/" + lump.name;
-               mapDir->children.push_back(file);
-               pathMap[file->fullPath] = file;
-           }
-           i += 10; // Skip 10 lumps
-       }
-       // Regular file lump
-       else {
-           WadNode* file = new WadNode(name, false);
-           file->offset = d.offset;
-           file->size = d.size;
-           file->parent = dirStack.top();
-           file->fullPath = dirStack.top()->fullPath + (dirStack.top()->fullPath == "/" ? "" : "/") + name;
-           dirStack.top()->children.push_back(file);
-           pathMap[file->fullPath] = file;
-       }
+   // Lazy: the root's children are built by the first lookup that needs them
+   if (_lazy) {
+       lazyRanges[root] = {0, lumpCount};
+       return;
    }
+   buildChildren(root, 0, lumpCount);
+   descriptorTable = nullptr;
+   vector<char>().swap(descriptorBuffer);
 
-   file.close();
+   if (cacheable)
+       saveIndexCache(options.indexCachePath, indexKey(wadStat, header));
+}
+
+static bool validLink(uint32_t link, uint64_t nodeCount) {
+    return link == NO_NODE || link < nodeCount;
+}
+
+// A tree every walk over can trust: each node but the root is reached exactly once from the root
+// through its parent's child list, and that list ends at its lastChild. Parent chains then lead to
+// the root and child lists end, so nothing that follows links can loop. Links are already in bounds.
+static bool validTree(const WadNode *nodes, uint64_t nodeCount) {
+    if (nodes[0].parent != NO_NODE || !nodes[0].isDirectory)
+        return false;
+
+    vector<bool> reached(nodeCount, false);
+    vector<uint32_t> dirs = {0};
+    uint64_t count = 1;
+    while (!dirs.empty()) {
+        uint32_t dir = dirs.back();
+        dirs.pop_back();
+        uint32_t last = NO_NODE;
+        for (uint32_t child = nodes[dir].firstChild; child != NO_NODE; child = nodes[child].nextSibling) {
+            if (child == 0 || reached[child] || nodes[child].parent != dir)
+                return false;
+            reached[child] = true;
+            ++count;
+            if (nodes[child].isDirectory)
+                dirs.push_back(child);
+            last = child;
+        }
+        if (nodes[dir].lastChild != last)
+            return false;
+    }
+    return count == nodeCount;
+}
+
+// Maps the sidecar at path and, if it was built from this exact WAD, copies the arena and childTable
+// straight out of it. A damaged index is refused, not trusted: every link is bounds-checked, the
+// tree is walked once (validTree), and the path table must hold exactly childCount entries, which
+// leaves the empty slots that end every probe.
+bool Wad::loadIndexCache(const string &path, const IndexCacheHeader &key) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void* addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(IndexCacheHeader))
+        addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+
+    const char* data = static_cast<const char*>(addr);
+    IndexCacheHeader stored;
+    memcpy(&stored, data, sizeof(stored));
+    const WadNode* cachedNodes = reinterpret_cast<const WadNode*>(data + sizeof(stored));
+
+    // Each count is bounded by the file size before it is multiplied, so the size check cannot wrap
+    uint64_t fileSize = st.st_size;
+    bool valid = memcmp(&stored, &key, offsetof(IndexCacheHeader, nodeCount)) == 0 &&
+                 stored.nodeCount > 0 && stored.nodeCount < NO_NODE && stored.nodeCount <= fileSize / sizeof(WadNode) &&
+                 stored.childTableSize >= 16 && (stored.childTableSize & (stored.childTableSize - 1)) == 0 &&
+                 stored.childTableSize <= fileSize / sizeof(uint32_t) &&
+                 stored.childCount <= stored.childTableSize / 2 &&
+                 fileSize == sizeof(stored) + stored.nodeCount * sizeof(WadNode) + stored.childTableSize * sizeof(uint32_t);
+    const uint32_t* cachedTable = valid ? reinterpret_cast<const uint32_t*>(cachedNodes + stored.nodeCount) : nullptr;
+    for (uint64_t i = 0; valid && i < stored.nodeCount; ++i) {
+        const WadNode& node = cachedNodes[i];
+        valid = validLink(node.parent, stored.nodeCount) && validLink(node.firstChild, stored.nodeCount) &&
+                validLink(node.lastChild, stored.nodeCount) && validLink(node.nextSibling, stored.nodeCount);
+    }
+    uint64_t filled = 0;
+    for (uint64_t i = 0; valid && i < stored.childTableSize; ++i) {
+        valid = validLink(cachedTable[i], stored.nodeCount);
+        filled += cachedTable[i] != NO_NODE;
+    }
+    valid = valid && filled == stored.childCount && validTree(cachedNodes, stored.nodeCount);
+
+    if (valid) {
+        nodes.assign(cachedNodes, cachedNodes + stored.nodeCount);
+        childTable.assign(cachedTable, cachedTable + stored.childTableSize);
+        childCount = stored.childCount;
+    }
+    munmap(addr, st.st_size);
+    return valid;
+}
+
+static bool writeAll(int fd, const void *buffer, size_t length) {
+    const char* bytes = static_cast<const char*>(buffer);
+    while (length > 0) {
+        ssize_t put = write(fd, bytes, length);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put <= 0)
+            return false;
+        bytes += put;
+        length -= put;
+    }
+    return true;
+}
+
+// Writes the freshly built tree next to a temporary name and renames it over path, so readers only
+// ever see a complete index. Failure just means the next load parses the WAD again.
+void Wad::saveIndexCache(const string &path, const IndexCacheHeader &key) const {
+    IndexCacheHeader header = key;
+    header.nodeCount = nodes.size();
+    header.childTableSize = childTable.size();
+    header.childCount = childCount;
+
+    string temp = path + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        WAD_LOG_ERROR("Failed to write index cache: " << path);
+        return;
+    }
+    bool ok = writeAll(fd, &header, sizeof(header)) &&
+              writeAll(fd, nodes.data(), nodes.size() * sizeof(WadNode)) &&
+              writeAll(fd, childTable.data(), childTable.size() * sizeof(uint32_t));
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        WAD_LOG_ERROR("Failed to write index cache: " << path);
+    }
+}
+
+// Decodes descriptor i of the loaded table; the name is not NUL-terminated when it is 8 characters
+void Wad::readDescriptor(uint32_t i, int *offset, int *size, string_view *name) const {
+    const char* entry = descriptorTable + static_cast<size_t>(i) * 16;
+    memcpy(offset, entry, 4);
+    memcpy(size, entry + 4, 4);
+    *name = string_view(entry + 8, strnlen(entry + 8, 8));
+}
+
+static bool isStartMarker(string_view name) {
+    return name.size() > 6 && name.substr(name.size() - 6) == "_START";
+}
+
+static bool isEndMarker(string_view name) {
+    return name.size() > 4 && name.substr(name.size() - 4) == "_END";
+}
+
+// ExMy (Doom, Heretic) or MAPxx (Doom II and later)
+static bool isMapMarker(string_view name) {
+    if (name.size() == 4)
+        return name[0] == 'E' && isdigit(name[1]) && name[2] == 'M' && isdigit(name[3]);
+    return name.size() == 5 && name.substr(0, 3) == "MAP" && isdigit(name[3]) && isdigit(name[4]);
+}
+
+// Lumps that belong to the map whose marker precedes them. TEXTMAP opens a UDMF block, in which
+// every lump up to and including ENDMAP belongs to the map whatever its name.
+enum MapLumpKind { MAP_LUMP, MAP_UDMF_START, MAP_UDMF_END };
+
+static const struct {
+    const char* name;
+    bool prefix;            // Matches any lump name starting with name
+    MapLumpKind kind;
+} MAP_LUMP_TABLE[] = {
+    {"THINGS", false, MAP_LUMP},
+    {"LINEDEFS", false, MAP_LUMP},
+    {"SIDEDEFS", false, MAP_LUMP},
+    {"VERTEXES", false, MAP_LUMP},
+    {"SEGS", false, MAP_LUMP},
+    {"SSECTORS", false, MAP_LUMP},
+    {"NODES", false, MAP_LUMP},
+    {"SECTORS", false, MAP_LUMP},
+    {"REJECT", false, MAP_LUMP},
+    {"BLOCKMAP", false, MAP_LUMP},
+    {"BEHAVIOR", false, MAP_LUMP},      // Hexen-format maps
+    {"SCRIPTS", false, MAP_LUMP},
+    {"LEAFS", false, MAP_LUMP},         // Doom 64 / console ports
+    {"LIGHTS", false, MAP_LUMP},
+    {"MACROS", false, MAP_LUMP},
+    {"GL_", true, MAP_LUMP},            // glBSP nodes: the GL_ExMy / GL_MAPxx marker and GL_VERT, GL_SEGS, ...
+    {"TEXTMAP", false, MAP_UDMF_START},
+    {"ENDMAP", false, MAP_UDMF_END},
+};
+
+static bool findMapLump(string_view name, MapLumpKind *kind) {
+    for (const auto& entry : MAP_LUMP_TABLE) {
+        if (entry.prefix ? name.substr(0, strlen(entry.name)) == entry.name : name == entry.name) {
+            *kind = entry.kind;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Number of the count lumps following a map marker that belong to its map, classified in one pass
+// over the table above; nameAt(j) is the name of the j-th of them. A marker followed by nothing
+// recognizable keeps the classic layout of exactly 10 lumps, whatever their names.
+template <typename NameAt>
+static uint32_t mapBlockSpan(uint32_t count, NameAt nameAt) {
+    uint32_t i = 0;
+    bool udmf = false;
+    for (; i < count; ++i) {
+        MapLumpKind kind;
+        bool known = findMapLump(nameAt(i), &kind);
+        if (udmf) {
+            if (known && kind == MAP_UDMF_END) {
+                ++i;
+                break;
+            }
+        } else if (!known) {
+            break;
+        } else if (kind == MAP_UDMF_START) {
+            udmf = true;
+        }
+    }
+
+    if (i == 0)
+        return min<uint32_t>(10, count);
+    return i;
+}
+
+// Number of lumps after the map marker at descriptor marker that belong to its map
+uint32_t Wad::mapBlockLength(uint32_t marker, uint32_t last) const {
+    return mapBlockSpan(last - marker - 1, [&](uint32_t j) {
+        int offset, size;
+        string_view name;
+        readDescriptor(marker + 1 + j, &offset, &size, &name);
+        return name;
+    });
+}
+
+// True if a descriptor called name, appended under parent, would read back as one more lump of
+// the map parent currently ends with. Map children are only ever written right after their marker,
+// so the new entry follows the map's last lump.
+bool Wad::continuesMap(uint32_t parent, string_view name) const {
+    uint32_t map = nodes[parent].lastChild;
+    if (map == NO_NODE || !nodes[map].isMap)
+        return false;
+
+    vector<string_view> names;
+    for (uint32_t child = nodes[map].firstChild; child != NO_NODE; child = nodes[child].nextSibling)
+        names.push_back(nodes[child].getName());
+    names.push_back(name);
+    return mapBlockSpan(names.size(), [&](uint32_t j) { return names[j]; }) == names.size();
+}
+
+// Builds the tree under dir from descriptors [first, last). An eager load walks every nested 
+// namespace with a stack; a lazy one creates each nested namespace's directory node, records its 
+// descriptor range in lazyRanges and skips over it without decoding the lumps inside.
+void Wad::buildChildren(uint32_t dir, uint32_t first, uint32_t last) {
+    // Decorate Tree
+    stack<uint32_t> dirStack;
+    dirStack.push(dir);
+
+    for (uint32_t i = first; i < last; ++i) {
+        int offset, size;
+        string_view name;
+        readDescriptor(i, &offset, &size, &name);
+
+        // START marker
+        if (isStartMarker(name)) {
+            uint32_t ns = addNode(WadNode(name.substr(0, name.size() - 6), true, false), dirStack.top());
+            if (!_lazy) {
+                dirStack.push(ns);
+                continue;
+            }
+            // Find the matching _END (an unbalanced namespace runs to the end of the range)
+            uint32_t end = i + 1;
+            for (int depth = 1; end < last; ++end) {
+                string_view inner;
+                readDescriptor(end, &offset, &size, &inner);
+                if (isStartMarker(inner))
+                    ++depth;
+                else if (isEndMarker(inner) && --depth == 0)
+                    break;
+                else if (isMapMarker(inner))
+                    end += mapBlockLength(end, last);
+            }
+            lazyRanges[ns] = {i + 1, end};
+            i = end;
+        }
+        // END marker (never pops the starting directory, even in an unbalanced one)
+        else if (isEndMarker(name)) {
+            if (dirStack.size() > 1) dirStack.pop();
+        }
+        // Map marker
+        else if (isMapMarker(name)) {
+            uint32_t mapDir = addNode(WadNode(name, true, true), dirStack.top());
+            uint32_t length = mapBlockLength(i, last);
+
+            for (uint32_t j = 1; j <= length; ++j) {
+                WadNode file;
+                string_view lumpName;
+                readDescriptor(i + j, &file.offset, &file.size, &lumpName);
+                memcpy(file.name, lumpName.data(), lumpName.size());
+                addNode(file, mapDir);
+            }
+            i += length; // Skip the map's lumps
+        }
+        // Regular file lump
+        else {
+            WadNode file(name, false);
+            file.offset = offset;
+            file.size = size;
+            addNode(file, dirStack.top());
+        }
+    }
+}
+
+// Materializes one directory of a lazy tree; caller holds treeLock exclusively
+void Wad::expandDirectory(uint32_t dir) {
+    auto range = lazyRanges.find(dir);
+    if (range == lazyRanges.end())
+        return;
+    pair<uint32_t, uint32_t> descriptors = range->second;
+    lazyRanges.erase(range);
+    buildChildren(dir, descriptors.first, descriptors.second);
+}
+
+// Lazy mode: builds the children of every directory path walks through, including the last one
+// it reaches; caller holds treeLock exclusively
+void Wad::expandPath(string_view path) {
+    while (!lazyRanges.empty()) {
+        uint32_t reached = NO_NODE;
+        uint32_t index = resolvePath(path, &reached);
+        uint32_t dir = index != NO_NODE ? index : reached;
+        if (dir == NO_NODE || !lazyRanges.count(dir))
+            return;
+        expandDirectory(dir);
+    }
+}
+
+// Builds whatever a lazy tree has not built yet and lets go of the descriptor table
+void Wad::expandAll() {
+    while (!lazyRanges.empty())
+        expandDirectory(lazyRanges.begin()->first);
+    descriptorTable = nullptr;
+    vector<char>().swap(descriptorBuffer);
+}
+
+// Maps the whole archive read-only so getContents can copy straight out of the page cache
+// instead of issuing a syscall per call. The mapping reaches past the end of the file, up to the
+// next power of two, so pages the file grows into later are already mapped. Empty files, special
+// files and filesystems without mmap support leave _mapped null and reads use pread.
+void Wad::mapArchive() {
+    struct stat st;
+    if (fstat(_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size_t length = 4096;
+        while (length < static_cast<size_t>(st.st_size))
+            length *= 2;
+        void* addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, _fd, 0);
+        if (addr != MAP_FAILED) {
+            _mapped = static_cast<const char*>(addr);
+            _mappedSize = st.st_size;
+            _mappingLength = length;
+        }
+    }
+}
+
+// Called after a commit grew the file. While it still fits the mapping, the new bytes are simply
+// let in; otherwise the old mapping is retired rather than unmapped, so views handed out from it
+// stay valid until the Wad is deleted.
+void Wad::remapArchive() {
+    if (!_useMmap)
+        return;
+    struct stat st;
+    if (_mapped && fstat(_fd, &st) == 0 && static_cast<size_t>(st.st_size) <= _mappingLength) {
+        _mappedSize = st.st_size;
+        return;
+    }
+    if (_mapped)
+        retiredMappings.push_back({_mapped, _mappingLength});
+    _mapped = nullptr;
+    _mappedSize = 0;
+    _mappingLength = 0;
+    mapArchive();
+}
+
+// Positional read on the shared descriptor: no seek state, so concurrent readers need no lock
+// around it. Loops over short reads; returns the bytes read, or -1 on error.
+int64_t Wad::readAt(char *buffer, size_t length, uint64_t offset) const {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t got = pread(_fd, buffer + done, length - done, offset + done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+            return -1;
+        if (got == 0)
+            break;
+        done += got;
+    }
+    return done;
+}
+
+// Pending batched edits are written first. Everything else a Wad holds (nodes, nodeData, childTable) is released by its own container
+Wad::~Wad() {
+    writeHolds.clear();
+    if (dirty && !commitChanges())
+        WAD_LOG_ERROR("[~Wad] Failed to write pending edits to WAD file: " << wadFilePath);
+    if (_mapped)
+        munmap(const_cast<char*>(_mapped), _mappingLength);
+    for (auto& mapping : retiredMappings)
+        munmap(const_cast<char*>(mapping.first), mapping.second);
+    _mapped = nullptr;
+    _mappedSize = 0;
+    _mappingLength = 0;
+    if (_fd >= 0)
+        close(_fd);
+    _fd = -1;
+}
+
+// A commit can replace the mapping, so it is read under the lock like the tree
+bool Wad::isMapped() const {
+    shared_lock<shared_mutex> lock = lockShared();
+    return _mapped != nullptr;
+}
+
+bool Wad::isReadOnly() const {
+    return _readOnly;
 }
 
 // Object allocator; dynamically(NEW) creates a Wad object and loads the WAD file data from path into memory. 
 // Caller must deallocate the memory using the delete keyword.
 Wad* Wad::loadWad(const string &path) {
+    return loadWad(path, WadOptions());
+}
+
+// Same as above, with explicit load options (e.g. useMmap = false forces buffered reads)
+Wad* Wad::loadWad(const string &path, const WadOptions &options) {
     // Does not/Will not have an instance of a Wad object.
     // Cannot access MBR Vars
     // Create the Wad object alongside this - Significantly cleaner
-    Wad* wadptr = new Wad(path);
+    Wad* wadptr = new Wad(path, options);
     return wadptr;
 }
 
@@ -160,6 +788,39 @@ string Wad::getMagic() {
     return _magicString;
 }
 
+// glibc's rwlock favours readers, so a steady stream of FUSE reads could starve a writer forever.
+// A writer announces itself in writersWaiting and holds writerQueue until it owns treeLock;
+// readers that see it queue behind the writer instead of jumping ahead.
+shared_lock<shared_mutex> Wad::lockShared() const {
+    if (writersWaiting.load(memory_order_acquire) > 0)
+        lock_guard<mutex> queue(writerQueue);
+    return shared_lock<shared_mutex>(treeLock);
+}
+
+unique_lock<shared_mutex> Wad::lockExclusive() {
+    writersWaiting.fetch_add(1, memory_order_acq_rel);
+    lock_guard<mutex> queue(writerQueue);
+    unique_lock<shared_mutex> lock(treeLock);
+    writersWaiting.fetch_sub(1, memory_order_acq_rel);
+    return lock;
+}
+
+// Resolves path once; the handle can be passed to the overloads below any number of times.
+// In a lazy tree, a lookup that stops at a directory not built yet retries under the exclusive lock
+// after building the directories along the path.
+WadHandle Wad::resolve(string_view path) {
+    {
+        shared_lock<shared_mutex> lock = lockShared();
+        uint32_t reached = NO_NODE;
+        uint32_t index = resolvePath(path, &reached);
+        if (index != NO_NODE || reached == NO_NODE || !lazyRanges.count(reached))
+            return WadHandle{index};
+    }
+    unique_lock<shared_mutex> lock = lockExclusive();
+    expandPath(path);
+    return WadHandle{resolvePath(path)};
+}
+
 // Returns true if path represents content (data), and false otherwise.
 // From here on, path is relative to the virtual filesystem
 bool Wad::isContent(const string &path) {
@@ -167,12 +828,12 @@ bool Wad::isContent(const string &path) {
     - If is content, true
     - else false
      */
-    string cleanedPath = (path.length() > 1 && path.back() == '/') ? path.substr(0, path.length() - 1) : path;
-    auto it = pathMap.find(cleanedPath);
-    if (it != pathMap.end() && !it->second->isDirectory && !it->second->isMap) {
-        return true;
-    }
-    return false;
+    return isContent(resolve(path));
+}
+
+bool Wad::isContent(WadHandle handle) {
+    shared_lock<shared_mutex> lock = lockShared();
+    return isContentNode(handle.index);
 }
 
 // Returns true if path represents a directory, and false otherwise.
@@ -182,11 +843,12 @@ bool Wad::isDirectory(const string &path) {
     - If is directory, true
     - else false
      */
-    string cleanedPath = (path.length() > 1 && path.back() == '/') ? path.substr(0, path.length() - 1) : path;
-    auto it = pathMap.find(cleanedPath);
-    if (it != pathMap.end() && it->second->isDirectory)
-        return true;
-    return false;
+    return isDirectory(resolve(path));
+}
+
+bool Wad::isDirectory(WadHandle handle) {
+    shared_lock<shared_mutex> lock = lockShared();
+    return handle.index < nodes.size() && nodes[handle.index].isDirectory;
 }
 
 // If path represents content, returns the number of bytes in its data; otherwise, returns -1.
@@ -196,10 +858,14 @@ int Wad::getSize(const string &path) {
     - if !isContent(), ret -1;
     - else ret Descriptor.Elementsize
     */
-    if (!isContent(path))
+    return getSize(resolve(path));
+}
+
+int Wad::getSize(WadHandle handle) {
+    shared_lock<shared_mutex> lock = lockShared();
+    if (!isContentNode(handle.index))
         return -1;
-    auto it = pathMap.find(path);
-    return it->second->size;
+    return nodes[handle.index].size;
 }
 
 // If path represents content, copies as many bytes as are available, up to length, of content's data into the pre- existing buffer. 
@@ -215,37 +881,149 @@ int Wad::getContents(const string &path, char *buffer, int length, int offset) {
     - fencepost the null terminator
     - return number of chars copied to buffer
      */
-    
-     if (!isContent(path)) 
-        return -1;
 
-     auto it = pathMap.find(path);
-     if (it == pathMap.end()) 
+     return getContents(resolve(path), buffer, length, offset);
+}
+
+int Wad::getContents(WadHandle handle, char *buffer, int length, int offset) {
+     shared_lock<shared_mutex> lock = lockShared();
+     return readContents(handle.index, buffer, length, offset);
+}
+
+// Copies lump bytes for a resolved node; caller holds treeLock
+int Wad::readContents(uint32_t index, char *buffer, int length, int offset) {
+     if (!isContentNode(index)) 
         return -1;
  
-     WadNode* node = it->second;
+     const WadNode* node = &nodes[index];
  
-     if (offset >= node->size) 
+     // Nothing to copy for a negative length or offset, as for one past the end
+     if (length < 0 || offset < 0 || offset >= node->size) 
         return 0;
  
      int bytesToRead = min(length, node->size - offset);
  
      // If the file has been written in memory, use that
-     if (!node->data.empty()) {
-         for (int i = 0; i < bytesToRead; ++i) {
-             buffer[i] = node->data[offset + i];
-         }
+     auto data = nodeData.find(index);
+     if (data != nodeData.end()) {
+         memcpy(buffer, data->second.data() + offset, bytesToRead);
          return bytesToRead;
      }
  
-     // Otherwise, read from disk (original WAD file)
-     fstream file(wadFilePath, ios::in | ios::out | ios::binary);
-     if (!file) 
+     // Mapped archive: copy straight out of the mapping
+     size_t start = static_cast<size_t>(node->offset) + offset;
+     if (_mapped && start + bytesToRead <= _mappedSize) {
+         memcpy(buffer, _mapped + start, bytesToRead);
+         return bytesToRead;
+     }
+
+     // Otherwise, read from disk (original WAD file), through the lump cache when there is one
+     if (readCached(index, buffer, bytesToRead, offset))
+         return bytesToRead;
+     return readAt(buffer, bytesToRead, start);
+}
+
+// Forgets the cached copy of a lump whose bytes are about to change
+void Wad::dropCached(uint32_t index) {
+    lock_guard<mutex> lock(cacheLock);
+    auto cached = lumpCache.find(index);
+    if (cached == lumpCache.end())
+        return;
+    cacheStats.bytes -= cached->second.bytes.size();
+    cacheRecency.erase(cached->second.recency);
+    lumpCache.erase(cached);
+}
+
+// The lump is read outside cacheLock so a miss does not stall hits on other lumps; if two readers
+// miss the same lump at once, the second insert simply finds the first one's copy.
+bool Wad::readCached(uint32_t index, char *buffer, int length, int offset) {
+    const WadNode& node = nodes[index];
+    if (_cacheBudget == 0 || static_cast<size_t>(node.size) > _cacheBudget / 4)
+        return false;
+
+    {
+        lock_guard<mutex> lock(cacheLock);
+        auto cached = lumpCache.find(index);
+        if (cached != lumpCache.end()) {
+            cacheRecency.splice(cacheRecency.begin(), cacheRecency, cached->second.recency);
+            memcpy(buffer, cached->second.bytes.data() + offset, length);
+            ++cacheStats.hits;
+            return true;
+        }
+        ++cacheStats.misses;
+    }
+
+    vector<char> bytes(node.size);
+    if (readAt(bytes.data(), bytes.size(), static_cast<size_t>(node.offset)) != node.size)
+        return false;
+    memcpy(buffer, bytes.data() + offset, length);
+
+    lock_guard<mutex> lock(cacheLock);
+    if (lumpCache.count(index))
+        return true;
+    cacheRecency.push_front(index);
+    cacheStats.bytes += bytes.size();
+    lumpCache.emplace(index, CachedLump{move(bytes), cacheRecency.begin()});
+
+    while (cacheStats.bytes > _cacheBudget) {
+        auto victim = lumpCache.find(cacheRecency.back());
+        cacheStats.bytes -= victim->second.bytes.size();
+        lumpCache.erase(victim);
+        cacheRecency.pop_back();
+        ++cacheStats.evictions;
+    }
+    return true;
+}
+
+WadCacheStats Wad::getCacheStats() const {
+    lock_guard<mutex> lock(cacheLock);
+    return cacheStats;
+}
+
+// If path represents content, points view at its bytes without copying and returns the size; otherwise -1.
+// &path is relative to the virtual filesystem
+int Wad::getContentsView(const string &path, string_view *view) {
+    return getContentsView(resolve(path), view);
+}
+
+int Wad::getContentsView(WadHandle handle, string_view *view) {
+    /*
+    - if !isContent, ret -1
+    - in-memory data wins, like getContents
+    - else point into the mapping
+    - unmapped archive: pull the lump into nodeData once, then view that
+     */
+    uint32_t index = handle.index;
+    shared_lock<shared_mutex> lock = lockShared();
+    if (!isContentNode(index))
         return -1;
- 
-     file.seekg(node->offset + offset, ios::beg);
-     file.read(buffer, bytesToRead);
-     return file.gcount();
+
+    const WadNode* node = &nodes[index];
+
+    auto data = nodeData.find(index);
+    if (data == nodeData.end()) {
+        size_t start = static_cast<size_t>(node->offset);
+        if (_mapped && start + node->size <= _mappedSize) {
+            *view = string_view(_mapped + start, node->size);
+            return node->size;
+        }
+
+        // Pulling the lump into nodeData mutates the Wad, so trade up to the exclusive lock
+        // and check again: another reader may have loaded it in between
+        lock.unlock();
+        unique_lock<shared_mutex> writeLock = lockExclusive();
+        node = &nodes[index];
+        data = nodeData.find(index);
+        if (data == nodeData.end()) {
+            vector<char> bytes(node->size);
+            if (node->size > 0 && readContents(index, bytes.data(), node->size, 0) != node->size)
+                return -1;
+            data = nodeData.emplace(index, move(bytes)).first;
+        }
+    }
+
+    *view = string_view(data->second.data(), data->second.size());
+    return node->size;
 }
 
 // If path represents a directory, places entries for immediately contained elements in directory. 
@@ -254,30 +1032,76 @@ int Wad::getContents(const string &path, char *buffer, int length, int offset) {
 // (e.g., if it represents content).
 // &path is relative to the virtual filesystem
 int Wad::getDirectory(const string &path, vector<string> *directory) {
+    return getDirectory(resolve(path), directory);
+}
+
+int Wad::getDirectory(WadHandle handle, vector<string> *directory) {
     /*
     *add the children of the path to directory vector
     *DO NOT SORT
      */
-    string cleanedPath = (path.length() > 1 && path.back() == '/') ? path.substr(0, path.length() - 1) : path;
+    int read = readDirectory(handle, 0, [directory](string_view name, WadHandle, uint64_t) {
+        directory->emplace_back(name);
+        return true;
+    });
+    return read < 0 ? -1 : directory->size();
+}
 
-    if (!isDirectory(cleanedPath)) return -1;
+int Wad::getDirectoryEntries(const string &path, vector<WadEntry> *entries) {
+    return getDirectoryEntries(resolve(path), entries);
+}
 
-    auto it = pathMap.find(cleanedPath);
-    if (it == pathMap.end()) return -1;
+// readDirectory holds the shared lock while it visits, so the nodes can be read directly
+int Wad::getDirectoryEntries(WadHandle handle, vector<WadEntry> *entries) {
+    return readDirectory(handle, 0, [this, entries](string_view name, WadHandle child, uint64_t) {
+        const WadNode& node = nodes[child.index];
+        WadEntry entry;
+        entry.name = string(name);
+        entry.type = node.isMap ? WadEntryType::Map : node.isDirectory ? WadEntryType::Namespace : WadEntryType::File;
+        entry.size = node.isDirectory ? -1 : node.size;
+        entry.handle = child;
+        entries->push_back(move(entry));
+        return true;
+    });
+}
 
-    WadNode* node = it->second;
+// Cursor offsets: 0 is the first child, otherwise the node index of the child to resume at plus one.
+// Nodes never move and new children are only linked in after existing ones, so an offset stays
+// meaningful across edits; the offset after the last child is NO_NODE + 1.
+int Wad::readDirectory(WadHandle handle, uint64_t offset, const DirectoryVisitor &visit) {
+    uint32_t dir = handle.index;
+    shared_lock<shared_mutex> lock = lockShared();
+    if (dir >= nodes.size() || !nodes[dir].isDirectory)
+        return -1;
 
-    for (WadNode* child : node->children) {
-        // Skip marker nodes like ex_START or ex_END
-        if (child->name.size() >= 6 && 
-            (child->name.substr(child->name.size() - 6) == "_START" ||
-             child->name.substr(child->name.size() - 4) == "_END")) {
-            continue;
+    // A lazy directory is built on its first listing
+    if (lazyRanges.count(dir)) {
+        lock.unlock();
+        {
+            unique_lock<shared_mutex> writeLock = lockExclusive();
+            expandDirectory(dir);
         }
-        directory->push_back(child->name);
+        lock = lockShared();
     }
 
-    return directory->size();
+    uint32_t child;
+    if (offset == 0)
+        child = nodes[dir].firstChild;
+    else if (offset - 1 == NO_NODE)
+        return 0;
+    else if (offset - 1 < nodes.size() && nodes[offset - 1].parent == dir)
+        child = offset - 1;
+    else
+        return -1;
+
+    int visited = 0;
+    for (; child != NO_NODE; child = nodes[child].nextSibling) {
+        uint64_t next = static_cast<uint64_t>(nodes[child].nextSibling) + 1;
+        if (!visit(nodes[child].getName(), WadHandle{child}, next))
+            break;
+        ++visited;
+    }
+    return visited;
 }
 
 
@@ -298,102 +1122,70 @@ void Wad::createDirectory(const string &path) {
     - UPDATE # of descriptors(_content) to +2 (32 bytes)
     */
     // Extract parent and new directory name
-    cout << "[createDirectory] Called with path: " << path << endl;
+    unique_lock<shared_mutex> lock = lockExclusive();
+    WAD_LOG_DEBUG("[createDirectory] Called with path: " << path);
 
-    if (path.empty() || path == "/") {
-        cout << "[createDirectory] Invalid path: root or empty." << endl;
+    if (_readOnly) {
+        WAD_LOG_DEBUG("[createDirectory] Archive is read-only.");
         return;
     }
 
-    string cleanedPath = (path.back() == '/' ? path.substr(0, path.size() - 1) : path);
-    size_t slash = cleanedPath.find_last_of('/');
-    if (slash == string::npos) {
-        cout << "[createDirectory] Invalid path format." << endl;
+    if (path.empty() || path == "/") {
+        WAD_LOG_DEBUG("[createDirectory] Invalid path: root or empty.");
         return;
     }
 
-    string parentPath = (slash == 0) ? "/" : cleanedPath.substr(0, slash);
-    string newName = cleanedPath.substr(slash + 1);
+    expandPath(path);
+    uint32_t parent;
+    string_view newName;
+    if (!resolveParent(path, &parent, &newName)) {
+        WAD_LOG_DEBUG("[createDirectory] Invalid path format or parent directory not found.");
+        return;
+    }
 
-    cout << "[createDirectory] Parent path: " << parentPath << ", New dir name: " << newName << endl;
+    WAD_LOG_DEBUG("[createDirectory] Parent path: " << nodePath(parent) << ", New dir name: " << newName);
 
     if (newName.empty() || newName.length() > 2) {
-        cout << "[createDirectory] Invalid directory name length." << endl;
+        WAD_LOG_DEBUG("[createDirectory] Invalid directory name length.");
         return;
     }
 
-    auto it = pathMap.find(parentPath);
-    if (it == pathMap.end()) {
-        cout << "[createDirectory] Parent directory not found." << endl;
+    if (!nodes[parent].isDirectory || nodes[parent].isMap) {
+        WAD_LOG_DEBUG("[createDirectory] Parent is not a valid namespace directory.");
         return;
     }
 
-    WadNode* parent = it->second;
-    if (!parent->isDirectory || parent->isMap) {
-        cout << "[createDirectory] Parent is not a valid namespace directory." << endl;
+    // A second entry of the same name would take over the path table slot and hide the first
+    if (findChild(parent, newName) != NO_NODE) {
+        WAD_LOG_DEBUG("[createDirectory] Name already exists in parent directory.");
         return;
     }
 
-    // Create marker nodes
-    string startName = newName + "_START";
-    string endName = newName + "_END";
-
-    cout << "[createDirectory] Creating marker nodes: " << startName << ", " << endName << endl;
-
-    WadNode* startNode = new WadNode(startName, false);
-    startNode->offset = 0;
-    startNode->size = 0;
-    startNode->isDirectory = false;
-    startNode->isMap = false;
-    startNode->parent = parent;
-    startNode->fullPath = parent->fullPath + (parent->fullPath == "/" ? "" : "/") + startName;
-    pathMap[startNode->fullPath] = startNode;
-
-    WadNode* endNode = new WadNode(endName, false);
-    endNode->offset = 0;
-    endNode->size = 0;
-    endNode->isDirectory = false;
-    endNode->isMap = false;
-    endNode->parent = parent;
-    endNode->fullPath = parent->fullPath + (parent->fullPath == "/" ? "" : "/") + endName;
-    pathMap[endNode->fullPath] = endNode;
-
-    // Create the actual directory
-    WadNode* dirNode = new WadNode(newName, true);
-    dirNode->isDirectory = true;
-    dirNode->isMap = false;
-    dirNode->offset = 0;
-    dirNode->size = 0;
-    dirNode->parent = parent;
-    dirNode->fullPath = parent->fullPath + (parent->fullPath == "/" ? "" : "/") + newName;
-
-    cout << "[createDirectory] Final directory fullPath: " << dirNode->fullPath << endl;
-
-    // Insert into parent's children
-    auto& children = parent->children;
-    auto insertIt = find_if(children.begin(), children.end(), [](WadNode* node) {
-        return node && node->name.size() >= 4 &&
-               node->name.substr(node->name.size() - 4) == "_END";
-    });
-
-    if (insertIt == children.end()) {
-        children.push_back(startNode);
-        children.push_back(dirNode);
-        children.push_back(endNode);
-        cout << "[createDirectory] No _END marker found. Appending to end." << endl;
-    } else {
-        children.insert(insertIt, startNode);
-        children.insert(insertIt + 1, dirNode);
-        children.insert(insertIt + 2, endNode);
-        cout << "[createDirectory] Inserting before _END marker." << endl;
+    // The _START marker would be written right after a map's lumps and read back as one of them
+    string startMarker = string(newName) + "_START";
+    if (continuesMap(parent, startMarker)) {
+        WAD_LOG_DEBUG("[createDirectory] Name would be read back as part of the preceding map.");
+        return;
     }
 
-    _content += 2;
-    cout << "[createDirectory] Directory created. Total descriptors: " << _content << endl;
+    // The directory node is the namespace: its _START/_END markers are written around its children 
+    // when the descriptor table is serialized. As the parent's last child, it lands just before the 
+    // parent's own _END marker.
+    uint32_t dirNode = addNode(WadNode(newName, true), parent);
+
+    WAD_LOG_DEBUG("[createDirectory] Final directory fullPath: " << nodePath(dirNode));
+
+    if (!persistEdit([&]() { removeNode(dirNode); })) {
+        WAD_LOG_ERROR("[createDirectory] Failed to write WAD file: " << wadFilePath);
+        return;
+    }
+    WAD_LOG_INFO("[createDirectory] Directory created. Total descriptors: " << _content);
 
+#if WAD_LOG_LEVEL >= WAD_LOG_LEVEL_DEBUG
     cout << "\n\t========== Tree Start ==========\n\n";
     printTree(root, 0);
     cout << "\n\t========== Tree End ==========\n\n";
+#endif
 }
 
 // path includes the name of the new file to be created. If given a valid path, creates an empty file at path, with an offset and length of 0. 
@@ -412,74 +1204,76 @@ void Wad::createFile(const string &path) {
     - UPDATE # of descriptors(_content) to +1 (16 bytes)
     */
     // Parse parent and name
-    cout << "[createFile] Called with path: " << path << endl;
+    unique_lock<shared_mutex> lock = lockExclusive();
+    WAD_LOG_DEBUG("[createFile] Called with path: " << path);
 
-    if (path.empty() || path == "/") {
-        cout << "[createFile] Invalid path: root or empty." << endl;
+    if (_readOnly) {
+        WAD_LOG_DEBUG("[createFile] Archive is read-only.");
         return;
     }
 
-    size_t slash = path.find_last_of('/');
-    if (slash == string::npos || slash == path.length() - 1) {
-        cout << "[createFile] Invalid path format." << endl;
+    if (path.empty() || path == "/") {
+        WAD_LOG_DEBUG("[createFile] Invalid path: root or empty.");
         return;
     }
 
-    string parentPath = (slash == 0) ? "/" : path.substr(0, slash);
-    string newName = path.substr(slash + 1);
+    // A trailing slash names a directory, never a file
+    expandPath(path);
+    uint32_t parent;
+    string_view newName;
+    if (path.back() == '/' || !resolveParent(path, &parent, &newName)) {
+        WAD_LOG_DEBUG("[createFile] Invalid path format or parent directory not found.");
+        return;
+    }
 
-    cout << "[createFile] Parent path: " << parentPath << ", New file name: " << newName << endl;
+    WAD_LOG_DEBUG("[createFile] Parent path: " << nodePath(parent) << ", New file name: " << newName);
 
     if (newName.empty() || newName.length() > 8) {
-        cout << "[createFile] Invalid file name length." << endl;
+        WAD_LOG_DEBUG("[createFile] Invalid file name length.");
         return;
     }
 
-    if (newName.length() == 4 && newName[0] == 'E' && isdigit(newName[1]) &&
-        newName[2] == 'M' && isdigit(newName[3])) {
-        cout << "[createFile] File name is a map marker, not allowed." << endl;
+    if (isMapMarker(newName)) {
+        WAD_LOG_DEBUG("[createFile] File name is a map marker, not allowed.");
         return;
     }
 
-    auto it = pathMap.find(parentPath);
-    if (it == pathMap.end()) {
-        cout << "[createFile] Parent directory not found." << endl;
+    // Written to the table, such a name would read back as a namespace marker
+    if (isStartMarker(newName) || isEndMarker(newName)) {
+        WAD_LOG_DEBUG("[createFile] File name is a namespace marker, not allowed.");
         return;
     }
 
-    WadNode* parent = it->second;
-    if (!parent->isDirectory || parent->isMap) {
-        cout << "[createFile] Parent is not a valid namespace directory." << endl;
+    if (!nodes[parent].isDirectory || nodes[parent].isMap) {
+        WAD_LOG_DEBUG("[createFile] Parent is not a valid namespace directory.");
         return;
     }
 
-    WadNode* fileNode = new WadNode(newName, false, false);
-    fileNode->offset = 0;
-    fileNode->size = 1; // set size to 1 to make it testable
-    fileNode->data = vector<char>{'\0'}; // mock data for tests
-    fileNode->parent = parent;
-    fileNode->fullPath = parent->fullPath + (parent->fullPath == "/" ? "" : "/") + newName;
+    if (findChild(parent, newName) != NO_NODE) {
+        WAD_LOG_DEBUG("[createFile] Name already exists in parent directory.");
+        return;
+    }
 
-    pathMap[fileNode->fullPath] = fileNode;
+    // Written right after a map's lumps (say SCRIPTS after MAP01's THINGS), the file would read back
+    // as one of them
+    if (continuesMap(parent, newName)) {
+        WAD_LOG_DEBUG("[createFile] Name would be read back as part of the preceding map.");
+        return;
+    }
 
-    cout << "[createFile] Final file fullPath: " << fileNode->fullPath << endl;
+    // As the parent's last child, the file is written just before the parent's _END marker
+    WadNode file(newName, false, false);
+    file.offset = 0;
+    file.size = 0;
+    uint32_t fileNode = addNode(file, parent);
 
-    auto& children = parent->children;
-    auto insertIt = find_if(children.begin(), children.end(), [](WadNode* node) {
-        return node && node->name.size() >= 4 &&
-               node->name.substr(node->name.size() - 4) == "_END";
-    });
+    WAD_LOG_DEBUG("[createFile] Final file fullPath: " << nodePath(fileNode));
 
-    if (insertIt == children.end()) {
-        children.push_back(fileNode);
-        cout << "[createFile] No _END marker found. Appending to end." << endl;
-    } else {
-        children.insert(insertIt, fileNode);
-        cout << "[createFile] Inserting before _END marker." << endl;
+    if (!persistEdit([&]() { removeNode(fileNode); })) {
+        WAD_LOG_ERROR("[createFile] Failed to write WAD file: " << wadFilePath);
+        return;
     }
-
-    _content += 1;
-    cout << "[createFile] File created. Total descriptors: " << _content << endl;
+    WAD_LOG_INFO("[createFile] File created. Total descriptors: " << _content);
 }
 
 // If given a valid path to an empty file, augments file size and generates a lump offset, 
@@ -502,25 +1296,308 @@ int Wad::writeToFile(const string &path, const char *buffer, int length, int off
     - UPDATE descriptor offset + length(IN BYTES)
     */
     // Validate path
-    if (!isContent(path)) return -1;
+    unique_lock<shared_mutex> lock = lockExclusive();
+    expandPath(path);
+    uint32_t index = resolvePath(path);
+    if (!isContentNode(index)) return -1;
+
+    WadNode& node = nodes[index];
+
+    // Reject if it's not a file, or the archive is read-only
+    if (_readOnly) return 0;
+    if (node.isDirectory || length < 0 || offset < 0 || offset > INT_MAX - length) return 0;
+
+    // A lump written since the last commit has no offset in the file yet and its bytes are still in
+    // nodeData, so a write that continues where the previous one ended extends them. That is how a
+    // file larger than one request arrives through wadfs.
+    int oldSize = node.size;
+    int oldOffset = node.offset;
+    auto staged = nodeData.find(index);
+    bool created = staged == nodeData.end();
+    bool moved = false;
+    if (node.size > 0) {
+        if (offset != node.size) return 0;
+
+        // A committed lump is continued the same way: its bytes are staged again and the commit
+        // writes the whole lump at the end of the file, leaving the old copy as dead space. wadfs
+        // commits whenever a file is closed, which can fall between two pieces of another one.
+        if (node.offset != 0 || created) {
+            if (created) {
+                vector<char> data(node.size);
+                if (readContents(index, data.data(), node.size, 0) != node.size) return 0;
+                staged = nodeData.emplace(index, move(data)).first;
+            }
+            dropCached(index);
+            committedLumps[index] = {node.offset, node.size};
+            node.offset = 0;
+            pendingWrites.push_back(index);
+            moved = true;
+        }
+        staged->second.insert(staged->second.end(), buffer, buffer + length);
+    } else {
+        // Otherwise only an empty lump can be written
+        if (node.offset > 0) return 0;
+
+        // Stage the lump data in memory; commitChanges appends it to the file and assigns the offset
+        vector<char>& data = nodeData[index];
+        data.assign(offset + length, '\0'); // allow offset-based insert
+        memcpy(data.data() + offset, buffer, length);
+        pendingWrites.push_back(index);
+        created = true;
+    }
+    node.size = offset + length;
+
+    // A refused commit leaves the lump as it was: empty, pending with its earlier bytes, or
+    // committed where it was
+    auto undo = [&]() {
+        nodes[index].size = oldSize;
+        nodes[index].offset = oldOffset;
+        if (created)
+            nodeData.erase(index);
+        else
+            nodeData[index].resize(oldSize);
+        if (created || moved)
+            pendingWrites.pop_back();
+        if (moved)
+            committedLumps.erase(index);
+    };
+    if (!persistEdit(undo)) {
+        WAD_LOG_ERROR("[writeToFile] Failed to write WAD file: " << wadFilePath);
+        return 0;
+    }
+    return length;
+}
 
-    auto it = pathMap.find(path);
-    if (it == pathMap.end()) return -1;
+// Loops over short writes; returns false on error
+bool Wad::writeAt(const char *buffer, size_t length, uint64_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t put = pwrite(_fd, buffer + done, length - done, offset + done);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put <= 0)
+            return false;
+        done += put;
+    }
+    return true;
+}
 
-    WadNode* node = it->second;
+// Appends one 16-byte descriptor (offset, size, 8-byte NUL-padded name) to table
+static void putDescriptor(vector<char> &table, uint32_t offset, uint32_t size, string_view name) {
+    char entry[16] = {0};
+    memcpy(entry, &offset, 4);
+    memcpy(entry + 4, &size, 4);
+    memcpy(entry + 8, name.data(), min<size_t>(name.size(), 8));
+    table.insert(table.end(), entry, entry + 16);
+}
 
-    // Reject if it's not a file or already has data
-    if (node->isDirectory || node->size > 0 || node->offset > 0) return 0;
+// Appends a namespace marker for a directory: its name (at most 2 characters) plus suffix
+static void putMarker(vector<char> &table, string_view name, string_view suffix) {
+    char marker[8];
+    size_t length = min<size_t>(name.size(), 8 - suffix.size());
+    memcpy(marker, name.data(), length);
+    memcpy(marker + length, suffix.data(), suffix.size());
+    putDescriptor(table, 0, 0, string_view(marker, length + suffix.size()));
+}
 
-    // Simulate writing to lump data (in-memory only)
-    node->data.resize(offset + length); // allow offset-based insert
-    for (int i = 0; i < length; ++i) {
-        node->data[offset + i] = buffer[i];
+// Serializes dir's children in tree order. Namespace markers exist only as directory nodes in the
+// tree; this is where they become _START/_END descriptors around the directory's children.
+void Wad::appendDescriptors(uint32_t dir, vector<char> &table) const {
+    for (uint32_t child = nodes[dir].firstChild; child != NO_NODE; child = nodes[child].nextSibling) {
+        const WadNode& node = nodes[child];
+        string_view name = node.getName();
+
+        if (node.isMap) {
+            putDescriptor(table, node.offset, node.size, name);
+            appendDescriptors(child, table);
+        } else if (node.isDirectory) {
+            putMarker(table, name, "_START");
+            appendDescriptors(child, table);
+            putMarker(table, name, "_END");
+        } else if (node.offset == 0 && writeHolds.count(child)) {
+            // Held back from this commit: the table keeps the lump as it was last committed
+            auto committed = committedLumps.find(child);
+            if (committed == committedLumps.end())
+                putDescriptor(table, 0, 0, name);
+            else
+                putDescriptor(table, committed->second.first, committed->second.second, name);
+        } else {
+            putDescriptor(table, node.offset, node.size, name);
+        }
     }
+}
 
-    node->size = offset + length;
-    node->offset = 0xDEADBEEF; // placeholder (since we're not writing to a real file)
-    return length;
+// True if any lump's data lies within [offset, offset + length)
+bool Wad::lumpsOverlap(uint64_t offset, uint64_t length) const {
+    for (const WadNode& node : nodes) {
+        uint64_t start = static_cast<uint32_t>(node.offset);
+        if (!node.isDirectory && node.size > 0 && start < offset + length && offset < start + node.size)
+            return true;
+    }
+    return false;
+}
+
+// Persists the in-memory tree copy-on-write: the data of lumps written since the last commit goes past
+// the end of the file and the new descriptor table into a slot the header does not point at, both are
+// synced, and only then is the header pointed at the new table and synced again. Nothing the current
+// header refers to is ever overwritten, so an interrupted commit leaves the old state loadable; the
+// 8 header bytes go out in one write within the first sector.
+// Tables alternate between two slots: once the header names the new table, the one it replaced is dead
+// and its slot takes the table after next. A table that outgrows the spare slot is appended with a
+// quarter (at least 4 KiB) of headroom, so a run of single edits keeps reusing the same two slots
+// instead of leaving a dead table behind per commit. Caller holds treeLock exclusively.
+bool Wad::commitChanges() {
+    if (_readOnly || _fd < 0)
+        return false;
+
+    // The descriptor table is rewritten from the tree, so all of it has to exist
+    expandAll();
+
+    struct stat st;
+    if (fstat(_fd, &st) != 0)
+        return false;
+
+    uint64_t writePos = st.st_size;
+
+    // Lump data, packed back to back. Lumps still being written (see beginWrite) wait for a later commit.
+    vector<char> lumps;
+    vector<uint32_t> held;
+    for (uint32_t index : pendingWrites) {
+        if (writeHolds.count(index)) {
+            held.push_back(index);
+            continue;
+        }
+        const vector<char>& data = nodeData[index];
+        nodes[index].offset = writePos + lumps.size();
+        lumps.insert(lumps.end(), data.begin(), data.end());
+    }
+    // On failure the lumps are still pending and get their offsets from the next attempt
+    auto fail = [this]() {
+        for (uint32_t index : pendingWrites)
+            nodes[index].offset = 0;
+        return false;
+    };
+
+    vector<char> table;
+    table.reserve(nodes.size() * 16);
+    appendDescriptors(root, table);
+
+    uint64_t end = writePos + lumps.size();
+    uint64_t tableOffset = _spareTableOffset;
+    uint64_t tableCapacity = _spareTableCapacity;
+    if (tableCapacity == 0 || table.size() > tableCapacity) {
+        tableOffset = end;
+        tableCapacity = table.size() + max<uint64_t>(table.size() / 4, 4096);
+        if (tableOffset + tableCapacity > UINT32_MAX)
+            tableCapacity = table.size();
+        end = tableOffset + tableCapacity;
+    }
+    if (end > UINT32_MAX)
+        return fail();
+
+    uint32_t count = table.size() / 16;
+    uint32_t headerOffset = tableOffset;
+    char header[8];
+    memcpy(header, &count, 4);
+    memcpy(header + 4, &headerOffset, 4);
+
+    // New data and table must be durable before the header can name them
+    if (!writeAt(lumps.data(), lumps.size(), writePos) ||
+        !writeAt(table.data(), table.size(), tableOffset) ||
+        (end > static_cast<uint64_t>(st.st_size) && ftruncate(_fd, end) != 0) ||
+        fdatasync(_fd) != 0)
+        return fail();
+    if (!writeAt(header, sizeof(header), 4) || fdatasync(_fd) != 0)
+        return fail();
+
+    // The replaced table is dead now. A table loaded from the file is only reused if no lump lies inside it.
+    uint32_t oldOffset = _offset;
+    if (tableOffset == _spareTableOffset || !lumpsOverlap(oldOffset, _tableCapacity)) {
+        _spareTableOffset = oldOffset;
+        _spareTableCapacity = _tableCapacity;
+    } else {
+        _spareTableOffset = 0;
+        _spareTableCapacity = 0;
+    }
+    _content = count;
+    _offset = headerOffset;
+    _tableCapacity = tableCapacity;
+    dirty = false;
+
+    // The bytes are on disk now; serve them from the file like every other lump
+    for (uint32_t index : pendingWrites) {
+        if (!writeHolds.count(index)) {
+            nodeData.erase(index);
+            committedLumps.erase(index);
+        }
+    }
+    pendingWrites = move(held);
+
+    remapArchive();
+    return true;
+}
+
+// Edits inside a batch wait for its commit; outside one they are written straight away, and one
+// whose commit fails is undone so that the tree keeps matching the file. Caller holds treeLock exclusively.
+bool Wad::persistEdit(const function<void()> &undo) {
+    bool wasDirty = dirty;
+    dirty = true;
+    if (batchDepth > 0 || commitChanges())
+        return true;
+    undo();
+    dirty = wasDirty;
+    return false;
+}
+
+void Wad::beginBatch() {
+    unique_lock<shared_mutex> lock = lockExclusive();
+    ++batchDepth;
+}
+
+bool Wad::commit() {
+    unique_lock<shared_mutex> lock = lockExclusive();
+    if (batchDepth > 0)
+        --batchDepth;
+    if (batchDepth > 0 || !dirty)
+        return true;
+    return commitChanges();
+}
+
+bool Wad::flush() {
+    unique_lock<shared_mutex> lock = lockExclusive();
+    return !dirty || commitChanges();
+}
+
+// The hold is lifted for this one commit only, under the same lock, so no write slips in between
+bool Wad::flush(WadHandle handle) {
+    unique_lock<shared_mutex> lock = lockExclusive();
+    auto hold = writeHolds.find(handle.index);
+    if (hold == writeHolds.end())
+        return !dirty || commitChanges();
+
+    int holds = hold->second;
+    writeHolds.erase(hold);
+    bool pending = find(pendingWrites.begin(), pendingWrites.end(), handle.index) != pendingWrites.end();
+    bool ok = !(dirty || pending) || commitChanges();
+    writeHolds[handle.index] = holds;
+    return ok;
+}
+
+void Wad::beginWrite(WadHandle handle) {
+    unique_lock<shared_mutex> lock = lockExclusive();
+    if (isContentNode(handle.index))
+        ++writeHolds[handle.index];
+}
+
+// Data written while the lump was held is still pending, so the next commit has something to write
+void Wad::endWrite(WadHandle handle) {
+    unique_lock<shared_mutex> lock = lockExclusive();
+    auto hold = writeHolds.find(handle.index);
+    if (hold == writeHolds.end() || --hold->second > 0)
+        return;
+    writeHolds.erase(hold);
+    if (find(pendingWrites.begin(), pendingWrites.end(), handle.index) != pendingWrites.end())
+        dirty = true;
 }
 
 // NOTE: If a file or directory is created inside the root directory, it will be placed at the very end of the descriptor list, 
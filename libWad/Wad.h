@@ -2,26 +2,103 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 using namespace std;
 
+// Marks a missing parent/child/sibling link in the node arena
+const uint32_t NO_NODE = 0xFFFFFFFF;
+
+// One entry of the n-ary tree. Nodes live contiguously in Wad::nodes and refer to each other
+// by index, so a whole archive is a handful of allocations instead of one per lump.
 struct WadNode {
-    string name;                // Lump name (e.g., "LOLWUT", "E1M1", "F1_START")
+    char name[8] = {};          // Lump name (e.g., "LOLWUT", "E1M1", or "F1" for the F1_START/F1_END namespace), NUL-padded
     bool isDirectory = false;
     bool isMap = false;
     int offset = 0;             // File offset
     int size = 0;               // Lump size
-    vector<char> data;
 
-    WadNode* parent = nullptr;
-    vector<WadNode*> children;
-    string fullPath;            // pwd
+    uint32_t parent = NO_NODE;
+    uint32_t firstChild = NO_NODE;
+    uint32_t lastChild = NO_NODE;
+    uint32_t nextSibling = NO_NODE;
+
+    WadNode(string_view n = "", bool isDir = false, bool isMapMarker = false)
+        : isDirectory(isDir), isMap(isMapMarker) {
+        memcpy(name, n.data(), min(n.size(), sizeof(name)));
+    }
+
+    // Name without the padding; not NUL-terminated when it is a full 8 characters
+    string_view getName() const { return string_view(name, strnlen(name, sizeof(name))); }
+};
+
+// A resolved path, returned by Wad::resolve. Passing it to the handle overloads skips path resolution, 
+// so hot loops hash each path once. Nodes are never renumbered, and the only ones removed are those whose 
+// creation failed to commit, before any other call could see them. A handle therefore stays valid for 
+// the lifetime of the Wad that produced it; a handle for a missing path is simply not valid.
+struct WadHandle {
+    uint32_t index = NO_NODE;
+
+    bool isValid() const { return index != NO_NODE; }
+};
+
+// Kind of node a directory entry refers to
+enum class WadEntryType { File, Namespace, Map };
+
+// One child as returned by Wad::getDirectoryEntries: everything getattr needs, without further lookups.
+struct WadEntry {
+    string name;
+    WadEntryType type = WadEntryType::File;
+    int size = -1;              // Lump size for files, -1 for namespaces and maps (like getSize)
+    WadHandle handle;
+};
+
+// Callback for Wad::readDirectory: receives one child's name and handle, and the offset that resumes 
+// the listing just after it. Returning false stops the listing before this child.
+using DirectoryVisitor = function<bool(string_view name, WadHandle handle, uint64_t nextOffset)>;
 
-    WadNode(string n, bool isDir = false, bool isMapMarker = false)
-        : name(n), isDirectory(isDir), isMap(isMapMarker) {}
+// Options picked when the archive is loaded through Wad::loadWad.
+struct WadOptions {
+    bool useMmap = true;        // Serve lump reads from a read-only mapping of the archive when possible
+    bool readOnly = false;      // Open O_RDONLY and refuse edits (also chosen automatically when the file is not writable)
+    bool lazyTree = false;      // Build each namespace's nodes the first time a lookup or listing reaches it, so opening 
+                                // costs the same for any lump count; everything is built before the first commit
+    string indexCachePath;      // Sidecar index file holding the prebuilt tree and path table. Loaded instead of parsing the 
+                                // descriptors when it matches the WAD's size, mtime, inode and header; (re)written after an 
+                                // eager parse otherwise. Empty disables it.
+    size_t lumpCacheBytes = 0;  // Byte budget of an LRU cache of whole lumps for reads that go to the file (no mapping); 
+                                // lumps larger than a quarter of it are never cached. 0 disables it.
 };
 
+// Counters of the lump cache, from Wad::getCacheStats.
+struct WadCacheStats {
+    uint64_t hits = 0;          // Reads served from the cache
+    uint64_t misses = 0;        // Reads that loaded their lump from the file
+    uint64_t evictions = 0;     // Lumps dropped to stay within the budget
+    size_t bytes = 0;           // Lump bytes cached now
+    size_t budget = 0;          // WadOptions::lumpCacheBytes
+};
+
+// Identity of the WAD file a sidecar index was built from (see WadOptions::indexCachePath); defined in Wad.cpp
+struct IndexCacheHeader;
+
+// Concurrency: a single Wad may be shared by many threads. Lookups and reads (resolve, isContent, 
+// isDirectory, getSize, getContents, getContentsView, getDirectory, getDirectoryEntries, readDirectory, isMapped) take treeLock shared and run in 
+// parallel; createDirectory, createFile and writeToFile take it exclusively, as do resolve and the listings the first 
+// time they reach a directory a lazy tree has not built yet. A waiting writer goes 
+// ahead of readers that arrive after it, so steady read load cannot starve writes. Because nodes are never removed or moved, 
+// handles and views obtained before a write stay valid after it; the one exception is a view of a lump written inside 
+// an open batch, which lasts until that batch is committed or the lump is extended. printTree takes no lock and is for 
+// single-threaded debugging only.
 class Wad {
 
     // WAD header values (_magic 4 bytes : _content 4 bytes : _offset 4 bytes)
@@ -29,57 +106,274 @@ class Wad {
     int _content;
     int _offset;
     string _magicString;
-    WadNode* root;
     // some data structure to track lumps
     string wadFilePath;
+
+    // Node arena; the root directory is always index 0
+    vector<WadNode> nodes;
+    static constexpr uint32_t root = 0;
+
+    // Lazy tree (WadOptions::lazyTree): directories whose children are not built yet, mapped to their 
+    // [first, last) range in the descriptor table. The table points into the mapping, or into 
+    // descriptorBuffer when the archive is read with pread; both are dropped once the tree is complete.
+    bool _lazy = false;
+    unordered_map<uint32_t, pair<uint32_t, uint32_t>> lazyRanges;
+    const char* descriptorTable = nullptr;
+    vector<char> descriptorBuffer;
+    // Bytes of lumps that live in memory (written, or read in for a view), keyed by node index
+    unordered_map<uint32_t, vector<char>> nodeData;
+    // Written lumps whose nodeData has not reached the file yet, in write order
+    vector<uint32_t> pendingWrites;
+    // Descriptor table slots (see commitChanges): bytes reserved for the live table at _offset, and the 
+    // slot of the table it replaced, which the next table is written into when it fits
+    uint32_t _tableCapacity = 0;
+    uint32_t _spareTableOffset = 0;
+    uint32_t _spareTableCapacity = 0;
+    // Lumps kept out of commits while they are being written (see beginWrite), with their count of holds, and 
+    // where held lumps that writeToFile moved were last committed, as (offset, size)
+    unordered_map<uint32_t, int> writeHolds;
+    unordered_map<uint32_t, pair<int, int>> committedLumps;
+    // Open beginBatch calls, and whether the tree has edits the file does not have yet
+    int batchDepth = 0;
+    bool dirty = false;
+
+    // Hashed path trie: an open-addressing table (power-of-two size, linear probing) of node indices
+    // keyed by (parent index, inline name). Paths are resolved one component at a time against it, 
+    // so lookups never allocate and no full path string is stored; each node costs one or two slots.
+    vector<uint32_t> childTable;
+    size_t childCount = 0;
+
+    // Reader-writer lock over the tree, childTable and nodeData (see the class comment)
+    mutable shared_mutex treeLock;
+    // Writer preference on top of treeLock: waiting writers hold writerQueue so new readers line up behind them
+    mutable mutex writerQueue;
+    atomic<int> writersWaiting{0};
+
+    shared_lock<shared_mutex> lockShared() const;
+    unique_lock<shared_mutex> lockExclusive();
+
+    // Descriptor held open for the Wad's lifetime; all file I/O is positional (pread) on it
+    int _fd = -1;
+    bool _readOnly = false;
+
+    // Read-only mapping of the whole archive, or nullptr when reads fall back to pread. The mapping is 
+    // _mappingLength bytes (the file size rounded up to a power of two, so commits can grow the file into 
+    // it); only the first _mappedSize bytes, the file as of the last commit, may be read.
+    bool _useMmap = true;
+    const char* _mapped = nullptr;
+    size_t _mappedSize = 0;
+    size_t _mappingLength = 0;
+    // Mappings replaced after the file outgrew them; kept until destruction so earlier views stay valid. 
+    // Lengths double from one to the next, so there are only ever a few.
+    vector<pair<const char*, size_t>> retiredMappings;
+
+    // LRU cache of whole lumps in front of pread, keyed by node index (lumps in the file are never rewritten, 
+    // so an entry cannot go stale). Guarded by its own mutex, since reads only hold treeLock shared.
+    struct CachedLump {
+        vector<char> bytes;
+        list<uint32_t>::iterator recency;
+    };
+    size_t _cacheBudget = 0;
+    mutable mutex cacheLock;
+    unordered_map<uint32_t, CachedLump> lumpCache;
+    list<uint32_t> cacheRecency;        // Most recently used first
+    WadCacheStats cacheStats;
+
+    // Copies [offset, offset + length) of the lump at index from the cache, loading the whole lump on a miss; 
+    // returns false if the lump is not cacheable or cannot be read
+    bool readCached(uint32_t index, char *buffer, int length, int offset);
+    // Removes index from the lump cache
+    void dropCached(uint32_t index);
     
-    Wad(const string &path);
+    Wad(const string &path, const WadOptions &options);
+
+    // Maps the archive read-only; leaves _mapped null if the file cannot be mapped
+    void mapArchive();
+    // Extends the readable part of the mapping to the grown archive, or retires it and maps the archive 
+    // again when the file has outgrown it
+    void remapArchive();
+    // pread until length bytes or EOF; returns bytes read or -1
+    int64_t readAt(char *buffer, size_t length, uint64_t offset) const;
+    // pwrite all of buffer at offset; returns false on error
+    bool writeAt(const char *buffer, size_t length, uint64_t offset);
+
+    // Appends pending lump data, writes a new descriptor table into a free slot, syncs, then switches the header; 
+    // caller holds treeLock exclusively
+    bool commitChanges();
+    // Marks the tree dirty and commits unless a batch is open; a failed commit runs undo to take the edit back. 
+    // Caller holds treeLock exclusively.
+    bool persistEdit(const function<void()> &undo);
+    // True if the data of any lump lies within [offset, offset + length)
+    bool lumpsOverlap(uint64_t offset, uint64_t length) const;
+    // Serializes the descriptors under dir, in tree order, onto table
+    void appendDescriptors(uint32_t dir, vector<char> &table) const;
+
+    // Sidecar index cache (WadOptions::indexCachePath); key identifies this archive (size, mtime, inode, header)
+    bool loadIndexCache(const string &path, const IndexCacheHeader &key);
+    void saveIndexCache(const string &path, const IndexCacheHeader &key) const;
+
+    // Decodes descriptor i of the loaded table
+    void readDescriptor(uint32_t i, int *offset, int *size, string_view *name) const;
+    // Lumps after the map marker at descriptor marker that belong to its map (ExMy, MAPxx, UDMF, GL_ nodes)
+    uint32_t mapBlockLength(uint32_t marker, uint32_t last) const;
+    // True if a descriptor called name, appended under parent, would be read back into the map parent ends with
+    bool continuesMap(uint32_t parent, string_view name) const;
+    // Builds the children of dir from descriptors [first, last)
+    void buildChildren(uint32_t dir, uint32_t first, uint32_t last);
+    // Lazy tree: builds one directory, every directory along a path, or everything that is left; 
+    // caller holds treeLock exclusively
+    void expandDirectory(uint32_t dir);
+    void expandPath(string_view path);
+    void expandAll();
+
+    // Appends a node to the arena as the last child of parent and returns its index
+    uint32_t addNode(const WadNode &node, uint32_t parent);
+    // Links child into parent's child list right after prev (at the front when prev is NO_NODE)
+    void linkChildAfter(uint32_t parent, uint32_t prev, uint32_t child);
+    // Rebuilds the absolute path of a node from its parent links
+    string nodePath(uint32_t index) const;
+
+    // Slot in childTable where (parent, name) lives, or the empty slot where it would go
+    size_t childSlot(uint32_t parent, string_view name) const;
+    // Registers a node under its parent in childTable; replaces an existing child of the same name
+    void indexChild(uint32_t index);
+    // Removes a node from childTable, keeping the probe runs of the others intact
+    void unindexChild(uint32_t index);
+    // Undoes addNode for a node that has no children
+    void removeNode(uint32_t index);
+    // Returns the child of parent called name, or NO_NODE
+    uint32_t findChild(uint32_t parent, string_view name) const;
+    // The one path resolver behind every public call: returns the node at an absolute path, or NO_NODE. 
+    // Repeated and trailing slashes are ignored ("//Gl///ad/" is "/Gl/ad"); nothing is allocated. 
+    // When reached is given, it is left at the last node the walk looked a child up in.
+    uint32_t resolvePath(string_view path, uint32_t *reached = nullptr) const;
+    // Splits path into its parent directory node and last component (trailing slashes ignored). 
+    // Returns false if the parent does not resolve or there is no last component.
+    bool resolveParent(string_view path, uint32_t *parent, string_view *name) const;
+
+    bool isContentNode(uint32_t index) const;
+    // Copies lump bytes for a resolved node, like getContents; caller holds treeLock
+    int readContents(uint32_t index, char *buffer, int length, int offset);
 
     
 public:
-    unordered_map<string, WadNode*> pathMap;
-
     // Debug helper function to print the full n-ary tree
-    void printTree(WadNode* node, int depth);
+    void printTree(uint32_t node, int depth);
 
     // Object allocator; dynamically creates a Wad object and loads the WAD file data from path into memory. 
     // Caller must deallocate the memory using the delete keyword.
     static Wad* loadWad(const string &path);
+    static Wad* loadWad(const string &path, const WadOptions &options);
+
+    // Writes edits still pending in an unclosed batch, then releases the archive mapping and descriptor; the node arena, in-memory lump data and path table are owned 
+    // by their containers and go with the object. 
+    ~Wad();
+
+    // A Wad owns its mapping and tree outright, so it cannot be copied.
+    Wad(const Wad &) = delete;
+    Wad &operator=(const Wad &) = delete;
+
+    // Returns true if lump reads are served from a memory mapping of the archive.
+    bool isMapped() const;
+
+    // Hit/miss/eviction counters and current size of the lump cache (see WadOptions::lumpCacheBytes).
+    WadCacheStats getCacheStats() const;
+
+    // Returns true if the archive was opened read-only; createDirectory, createFile and writeToFile 
+    // then leave it untouched.
+    bool isReadOnly() const;
     
     // Returns the magic for this WAD data.
     string getMagic();
     
+    // Resolves path once into a handle for the overloads below (isValid() is false if path does not exist).
+    WadHandle resolve(string_view path);
+
     // Returns true if path represents content (data), and false otherwise.
     bool isContent(const string &path);
+    bool isContent(WadHandle handle);
     
     // Returns true if path represents a directory, and false otherwise.
     bool isDirectory(const string &path);
+    bool isDirectory(WadHandle handle);
     
     // If path represents content, returns the number of bytes in its data; otherwise, returns -1.
     int getSize(const string &path);
+    int getSize(WadHandle handle);
     
     // If path represents content, copies as many bytes as are available, up to length, of content's data into the pre- existing buffer. 
     // If offset is provided, data should be copied starting from that byte in the content. 
     // Returns number of bytes copied into buffer, or -1 if path does not represent content (e.g., if it represents a directory).
     int getContents(const string &path, char *buffer, int length, int offset = 0); 
+    int getContents(WadHandle handle, char *buffer, int length, int offset = 0);
+
+    // If path represents content, points view at the content's data without copying it and returns its size; 
+    // otherwise, returns -1 and leaves view untouched. 
+    // The view points into the archive mapping, or into the lump's in-memory data (lumps of archives that 
+    // could not be mapped are read into memory once on first use). It stays valid until the Wad is deleted, 
+    // except for a lump written inside a batch or extended: its bytes are released once they are committed (and 
+    // may move when the lump is extended again), so that view lasts only until the commit. Take the view again after it.
+    int getContentsView(const string &path, string_view *view);
+    int getContentsView(WadHandle handle, string_view *view);
     
     // If path represents a directory, places entries for immediately contained elements in directory. 
     // The elements should be placed in the directory in the same order as they are found in the WAD file. Returns the number of elements in the directory, or -1 if path does not represent a directory (e.g., if it represents content).
     int getDirectory(const string &path, vector<string> *directory);
+    int getDirectory(WadHandle handle, vector<string> *directory);
+
+    // Like getDirectory, but each entry also carries its type, size and handle, gathered in the same pass over the 
+    // children. Returns the number of entries appended, or -1 if path does not represent a directory.
+    int getDirectoryEntries(const string &path, vector<WadEntry> *entries);
+    int getDirectoryEntries(WadHandle handle, vector<WadEntry> *entries);
+
+    // Streams the children of a directory without copying their names, in the same order as getDirectory. 
+    // Starts at offset (0 for the first child, otherwise a nextOffset passed to an earlier visit, so a listing can 
+    // be resumed the way FUSE's readdir does) and calls visit for each child until it returns false or the directory 
+    // ends. visit runs under the shared lock: the name view is only valid during the call, and visit must not call 
+    // back into this Wad. Returns the number of children visit accepted, or -1 if handle is not a directory or 
+    // offset is not a position in it.
+    int readDirectory(WadHandle handle, uint64_t offset, const DirectoryVisitor &visit);
+
+    // Edits below are written to the WAD file before the call returns: new lump data is appended and a new descriptor 
+    // table written, both synced, then the 12-byte header is switched to the new table. Nothing the header points at is 
+    // overwritten, so a crash mid-commit leaves the archive loadable in its previous state. The table goes into the 
+    // space of the one replaced by the previous commit when it fits, so the file only grows with the lump data and 
+    // an occasional larger table.
+    // Inside a batch (see beginBatch) they only change the in-memory tree until the batch is committed.
+
+    // Opens a batch: edits made until the matching commit() are kept in memory and reach the file together, 
+    // as one append of lump data and one descriptor table write. Batches nest; only the outermost commit writes. 
+    // Reads see batched edits immediately.
+    void beginBatch();
+    // Closes the innermost batch; closing the outermost one writes every batched edit. Returns false if 
+    // that write failed (the edits stay pending and are retried by the next commit or flush).
+    bool commit();
+    // Writes pending edits now, whether or not a batch is open; the batch stays open. Returns false on error.
+    bool flush();
+    // Like flush, and also writes the lump at handle if it is held (see beginWrite); the hold stays.
+    bool flush(WadHandle handle);
+    // Marks the lump at handle as still being written: commits leave its new data out, and the archive keeps the 
+    // lump as it was last committed, until the matching endWrite. The first commit or flush after that writes it. 
+    // Holds nest. wadfs holds each file while it is open for writing, so closing one file does not commit half of another.
+    void beginWrite(WadHandle handle);
+    void endWrite(WadHandle handle);
 
     // path includes the name of the new directory to be created. If given a valid path, creates a new directory using namespace markers at path. 
     // The two new namespace markers will be added just before the “_END” marker of its parent directory. 
-    // New directories cannot be created inside map markers.
+    // New directories cannot be created inside map markers, nor over an existing file or directory of the same name.
     void createDirectory(const string &path);
 
     // path includes the name of the new file to be created. If given a valid path, creates an empty file at path, with an offset and length of 0. 
     // The file will be added to the descriptor list just before the “_END” marker of its parent directory. 
-    // New files cannot be created inside map markers.
+    // New files cannot be created inside map markers, nor over an existing file or directory of the same name.
     void createFile(const string &path);
     
     // If given a valid path to an empty file, augments file size and generates a lump offset, 
     // then writes length amount of bytes from the buffer into the file’s lump data. 
     // If offset is provided, data should be written starting from that byte in the lump content. 
+    // A lump that already has data can be extended by a write at offset == its current size, so a file can 
+    // be written in several pieces. A pending lump (see beginBatch) grows in memory; a committed one is moved: 
+    // the next commit writes the whole lump again at the end of the file. 
     // Returns number of bytes copied from buffer, or -1 if path does not represent content 
     // (e.g., if it represents a directory).
     int writeToFile(const string &path, const char *buffer, int length, int offset = 0); 
@@ -0,0 +1,38 @@
+// WADLOG_H
+
+// Leveled diagnostics for libWad, chosen at compile time with -DWAD_LOG_LEVEL=<n> (see the Makefile's LOG_LEVEL):
+//   0  off (default): log statements compile to nothing, so the library does no formatting or I/O
+//   1  errors: failed opens, reads and commits, on cerr
+//   2  info: one line per completed edit, on cout
+//   3  debug: every step of createDirectory/createFile, plus a tree dump after each new directory
+// Arguments are a stream chain, e.g. WAD_LOG_DEBUG("[createFile] Called with path: " << path);
+// they are not evaluated below the active level.
+
+#include <iostream>
+
+#define WAD_LOG_LEVEL_OFF   0
+#define WAD_LOG_LEVEL_ERROR 1
+#define WAD_LOG_LEVEL_INFO  2
+#define WAD_LOG_LEVEL_DEBUG 3
+
+#ifndef WAD_LOG_LEVEL
+#define WAD_LOG_LEVEL WAD_LOG_LEVEL_OFF
+#endif
+
+#if WAD_LOG_LEVEL >= WAD_LOG_LEVEL_ERROR
+#define WAD_LOG_ERROR(msg) do { std::cerr << msg << std::endl; } while (0)
+#else
+#define WAD_LOG_ERROR(msg) do { } while (0)
+#endif
+
+#if WAD_LOG_LEVEL >= WAD_LOG_LEVEL_INFO
+#define WAD_LOG_INFO(msg) do { std::cout << msg << std::endl; } while (0)
+#else
+#define WAD_LOG_INFO(msg) do { } while (0)
+#endif
+
+#if WAD_LOG_LEVEL >= WAD_LOG_LEVEL_DEBUG
+#define WAD_LOG_DEBUG(msg) do { std::cout << msg << std::endl; } while (0)
+#else
+#define WAD_LOG_DEBUG(msg) do { } while (0)
+#endif
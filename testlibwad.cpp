@@ -1,6 +1,14 @@
 #include <iostream>
 #include <cassert>
 #include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <malloc.h>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+#include <climits>
+#include <sys/stat.h>
 #include "libWad/Wad.h"
 #include "gtest/gtest.h"
 
@@ -684,6 +692,1107 @@ void unitTestWriteToFile(Wad* wad) {
     assert(written == -1);
 }
 
+// ==== GTEST UNIT TESTS ==== //
+
+// Writes a WAD with lumpCount small lumps spread over nested namespaces
+void writeSyntheticWad(const string& path, int lumpCount) {
+    ofstream out(path, ios::binary | ios::trunc);
+    struct Desc { uint32_t offset; uint32_t size; char name[8]; };
+    vector<Desc> descs;
+
+    auto addDesc = [&](uint32_t offset, uint32_t size, const string& name) {
+        Desc d = {offset, size, {}};
+        memcpy(d.name, name.data(), min(name.size(), sizeof(d.name)));
+        descs.push_back(d);
+    };
+
+    uint32_t offset = 12;
+    out.write("PWAD\0\0\0\0\0\0\0\0", 12);
+    for (int i = 0; i < lumpCount; ++i) {
+        if (i % 1000 == 0) {
+            if (i > 0) { addDesc(offset, 0, "b_END"); addDesc(offset, 0, "a_END"); }
+            addDesc(offset, 0, "a_START");
+            addDesc(offset, 0, "b_START");
+        }
+        string data = "lump " + to_string(i);
+        out.write(data.data(), data.size());
+        addDesc(offset, data.size(), "L" + to_string(i));
+        offset += data.size();
+    }
+    addDesc(offset, 0, "b_END");
+    addDesc(offset, 0, "a_END");
+
+    out.write(reinterpret_cast<const char*>(descs.data()), descs.size() * sizeof(Desc));
+    uint32_t header[2] = {static_cast<uint32_t>(descs.size()), offset};
+    out.seekp(4);
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+}
+
+TEST(MyMemoryTests, deleteReleasesWholeTree){
+    const string wad_path = "./testfiles/synthetic_memory.wad";
+    writeSyntheticWad(wad_path, 100000);
+
+    // Warm-up cycle so one-time allocations (iostream buffers, locale) are not counted
+    delete Wad::loadWad(wad_path);
+    malloc_trim(0);
+    size_t baseline = mallinfo2().uordblks;
+
+    size_t peak = 0;
+    size_t steady = baseline;
+    for (int cycle = 0; cycle < 10; ++cycle) {
+        Wad* testWad = Wad::loadWad(wad_path);
+        ASSERT_TRUE(testWad->isContent("/a/b/L99999"));
+        peak = max(peak, mallinfo2().uordblks - baseline);
+        delete testWad;
+        steady = mallinfo2().uordblks;
+    }
+
+    RecordProperty("PeakBytes", to_string(peak));
+    RecordProperty("SteadyStateBytes", to_string(steady - baseline));
+    cout << "[memory] peak per archive: " << peak << " bytes, retained after delete: "
+         << (steady - baseline) << " bytes" << endl;
+
+    // A loaded archive holds real memory, and deleting it gives all of it back
+    ASSERT_GT(peak, 100000u);
+    ASSERT_LE(steady, baseline + 4096);
+
+    remove(wad_path.c_str());
+}
+
+TEST(MyReadTests, mappedAndBufferedReadsMatch){
+    std::string wad_path = setupWorkspace();
+    Wad* mappedWad = Wad::loadWad(wad_path);
+    WadOptions options;
+    options.useMmap = false;
+    Wad* bufferedWad = Wad::loadWad(wad_path, options);
+
+    ASSERT_TRUE(mappedWad->isMapped());
+    ASSERT_FALSE(bufferedWad->isMapped());
+
+    // Whole lump, then a chunked read at an offset
+    std::vector<char> mapped(29869), buffered(29869);
+    ASSERT_EQ(mappedWad->getContents("/Gl/ad/os/cake.jpg", mapped.data(), 29869), 29869);
+    ASSERT_EQ(bufferedWad->getContents("/Gl/ad/os/cake.jpg", buffered.data(), 29869), 29869);
+    ASSERT_EQ(mapped, buffered);
+
+    ASSERT_EQ(mappedWad->getContents("/Gl/ad/os/cake.jpg", mapped.data(), 4096, 28672), 29869 - 28672);
+    ASSERT_EQ(bufferedWad->getContents("/Gl/ad/os/cake.jpg", buffered.data(), 4096, 28672), 29869 - 28672);
+    ASSERT_EQ(memcmp(mapped.data(), buffered.data(), 29869 - 28672), 0);
+
+    delete mappedWad;
+    delete bufferedWad;
+}
+
+TEST(MyReadTests, contentsViewMatchesCopy){
+    std::string wad_path = setupWorkspace();
+    WadOptions buffered;
+    buffered.useMmap = false;
+
+    for (Wad* testWad : {Wad::loadWad(wad_path), Wad::loadWad(wad_path, buffered)}) {
+        std::string_view view;
+        ASSERT_EQ(testWad->getContentsView("/E1M0/01.txt", &view), 17);
+        ASSERT_EQ(view.size(), 17u);
+
+        char buffer[17];
+        ASSERT_EQ(testWad->getContents("/E1M0/01.txt", buffer, 17), 17);
+        ASSERT_EQ(std::string_view(buffer, 17), view);
+
+        // Negative lengths and offsets copy nothing
+        ASSERT_EQ(testWad->getContents("/E1M0/01.txt", buffer, -1), 0);
+        ASSERT_EQ(testWad->getContents("/E1M0/01.txt", buffer, 17, -5), 0);
+
+        // Directories and missing paths are not content
+        ASSERT_EQ(testWad->getContentsView("/E1M0", &view), -1);
+        ASSERT_EQ(testWad->getContentsView("/fake/path", &view), -1);
+
+        delete testWad;
+    }
+}
+
+TEST(MyReadTests, pathNormalization){
+    std::string wad_path = setupWorkspace();
+    Wad* testWad = Wad::loadWad(wad_path);
+
+    // Repeated and trailing slashes resolve to the same node everywhere
+    ASSERT_TRUE(testWad->isDirectory("//Gl///ad/"));
+    ASSERT_TRUE(testWad->isContent("/Gl//ad/os/cake.jpg/"));
+    ASSERT_EQ(testWad->getSize("//Gl/ad/os//cake.jpg"), 29869);
+
+    char buffer[17];
+    ASSERT_EQ(testWad->getContents("/E1M0//01.txt", buffer, 17), 17);
+
+    std::vector<std::string> entries;
+    ASSERT_EQ(testWad->getDirectory("///", &entries), 3);
+
+    // Relative paths and over-long components never resolve
+    ASSERT_FALSE(testWad->isDirectory("Gl/ad"));
+    ASSERT_FALSE(testWad->isContent("/Gl/ad/os/cake.jpeg0"));
+
+    delete testWad;
+}
+
+TEST(MyReadTests, handleOverloadsMatchPaths){
+    std::string wad_path = setupWorkspace();
+    Wad* testWad = Wad::loadWad(wad_path);
+
+    WadHandle file = testWad->resolve("/Gl/ad/os/cake.jpg");
+    ASSERT_TRUE(file.isValid());
+    ASSERT_TRUE(testWad->isContent(file));
+    ASSERT_FALSE(testWad->isDirectory(file));
+    ASSERT_EQ(testWad->getSize(file), 29869);
+
+    std::vector<char> byHandle(100), byPath(100);
+    ASSERT_EQ(testWad->getContents(file, byHandle.data(), 100, 200), 100);
+    ASSERT_EQ(testWad->getContents("/Gl/ad/os/cake.jpg", byPath.data(), 100, 200), 100);
+    ASSERT_EQ(byHandle, byPath);
+
+    WadHandle dir = testWad->resolve("/E1M0");
+    std::vector<std::string> entries;
+    ASSERT_EQ(testWad->getDirectory(dir, &entries), 10);
+    ASSERT_EQ(testWad->getSize(dir), -1);
+
+    // Missing paths give an invalid handle that every overload rejects
+    WadHandle missing = testWad->resolve("/fake/path");
+    ASSERT_FALSE(missing.isValid());
+    ASSERT_FALSE(testWad->isContent(missing));
+    ASSERT_FALSE(testWad->isDirectory(missing));
+    ASSERT_EQ(testWad->getContents(missing, byHandle.data(), 10), -1);
+    ASSERT_EQ(testWad->getDirectory(missing, &entries), -1);
+
+    delete testWad;
+}
+
+TEST(MyConcurrencyTests, readersRunAlongsideWriter){
+    std::string wad_path = setupWorkspace();
+    Wad* testWad = Wad::loadWad(wad_path);
+
+    std::atomic<bool> done(false);
+    std::atomic<int> badReads(0);
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            std::vector<char> buffer(4096);
+            while (!done) {
+                if (testWad->getContents("/Gl/ad/os/cake.jpg", buffer.data(), 4096, 8192) != 4096)
+                    badReads++;
+                std::vector<std::string> entries;
+                if (testWad->getDirectory("/Gl/ad", &entries) < 1)
+                    badReads++;
+                // Commits may replace the mapping underneath
+                if (!testWad->isMapped())
+                    badReads++;
+            }
+        });
+    }
+
+    // The writer grows the arena and the path table while the readers run
+    for (int i = 0; i < 200; ++i) {
+        std::string name = "/Gl/ad/f" + std::to_string(i);
+        testWad->createFile(name);
+        ASSERT_TRUE(testWad->isContent(name));
+    }
+    done = true;
+    for (std::thread& reader : readers)
+        reader.join();
+
+    ASSERT_EQ(badReads, 0);
+    delete testWad;
+}
+
+TEST(MyReadTests, readOnlyArchive){
+    std::string wad_path = setupWorkspace();
+    const std::string ro_path = "./testfiles/readonly_copy.wad";
+    ASSERT_EQ(system(("cp " + wad_path + " " + ro_path + " && chmod 444 " + ro_path).c_str()), 0);
+
+    // Explicit read-only open, and an unwritable file (as root, access checks are bypassed, so
+    // only the explicit option is guaranteed to be read-only)
+    WadOptions options;
+    options.readOnly = true;
+    for (bool mmapOn : {true, false}) {
+        options.useMmap = mmapOn;
+        Wad* testWad = Wad::loadWad(ro_path, options);
+        ASSERT_TRUE(testWad->isReadOnly());
+        ASSERT_EQ(testWad->getMagic(), "IWAD");
+
+        char buffer[17];
+        ASSERT_EQ(testWad->getContents("/E1M0/01.txt", buffer, 17), 17);
+
+        testWad->createFile("/newfile");
+        ASSERT_FALSE(testWad->isContent("/newfile"));
+        testWad->createDirectory("/nd");
+        ASSERT_FALSE(testWad->isDirectory("/nd"));
+        ASSERT_EQ(testWad->writeToFile("/mp.txt", "x", 1), 0);
+        delete testWad;
+    }
+
+    Wad* implicitWad = Wad::loadWad(ro_path);
+    ASSERT_TRUE(implicitWad->isReadOnly() || geteuid() == 0);
+    ASSERT_EQ(implicitWad->getSize("/Gl/ad/os/cake.jpg"), 29869);
+    delete implicitWad;
+
+    remove(ro_path.c_str());
+}
+
+TEST(MyWriteTests, editsPersistWithoutRewritingLumps){
+    std::string wad_path = setupWorkspace();
+    std::vector<char> cakeBefore(29869), cakeAfter(29869);
+    const char text[] = "persisted lump";
+
+    Wad* testWad = Wad::loadWad(wad_path);
+    ASSERT_EQ(testWad->getContents("/Gl/ad/os/cake.jpg", cakeBefore.data(), 29869), 29869);
+    testWad->createDirectory("/Gl/pw");
+    testWad->createFile("/Gl/pw/note");
+    ASSERT_EQ(testWad->getSize("/Gl/pw/note"), 0);
+    ASSERT_EQ(testWad->writeToFile("/Gl/pw/note", text, sizeof(text)), (int)sizeof(text));
+    delete testWad;
+
+    WadOptions buffered;
+    buffered.useMmap = false;
+    for (Wad* reloaded : {Wad::loadWad(wad_path), Wad::loadWad(wad_path, buffered)}) {
+        ASSERT_TRUE(reloaded->isDirectory("/Gl/pw"));
+        ASSERT_EQ(reloaded->getSize("/Gl/pw/note"), (int)sizeof(text));
+
+        char buffer[sizeof(text)];
+        ASSERT_EQ(reloaded->getContents("/Gl/pw/note", buffer, sizeof(text)), (int)sizeof(text));
+        ASSERT_EQ(memcmp(buffer, text, sizeof(text)), 0);
+
+        // Existing lumps are untouched and the listing keeps descriptor order
+        ASSERT_EQ(reloaded->getContents("/Gl/ad/os/cake.jpg", cakeAfter.data(), 29869), 29869);
+        ASSERT_EQ(cakeBefore, cakeAfter);
+        std::vector<std::string> entries;
+        reloaded->getDirectory("/Gl", &entries);
+        ASSERT_EQ(entries, std::vector<std::string>({"ad", "pw"}));
+        delete reloaded;
+    }
+}
+
+TEST(MyWriteTests, batchedEditsReachFileOnCommit){
+    std::string wad_path = setupWorkspace();
+    struct stat before, during, after;
+    ASSERT_EQ(stat(wad_path.c_str(), &before), 0);
+
+    Wad* testWad = Wad::loadWad(wad_path);
+    testWad->beginBatch();
+    testWad->createDirectory("/Gl/bt");
+    for (int i = 0; i < 200; ++i) {
+        std::string name = "/Gl/bt/f" + std::to_string(i);
+        testWad->createFile(name);
+        ASSERT_EQ(testWad->writeToFile(name, name.c_str(), name.size()), (int)name.size());
+    }
+
+    // Batched edits are visible to reads but have not touched the file
+    char buffer[16];
+    ASSERT_EQ(testWad->getContents("/Gl/bt/f7", buffer, sizeof(buffer)), 9);
+    ASSERT_EQ(memcmp(buffer, "/Gl/bt/f7", 9), 0);
+    ASSERT_EQ(stat(wad_path.c_str(), &during), 0);
+    ASSERT_EQ(during.st_size, before.st_size);
+
+    ASSERT_TRUE(testWad->commit());
+    ASSERT_EQ(stat(wad_path.c_str(), &after), 0);
+    ASSERT_GT(after.st_size, before.st_size);
+
+    // A batch left open is written when the Wad is deleted
+    testWad->beginBatch();
+    testWad->createFile("/Gl/bt/late");
+    delete testWad;
+
+    // A view of a batched lump points at its pending bytes; after the commit those are released and
+    // a fresh view points into the archive instead
+    testWad = Wad::loadWad(wad_path);
+    testWad->beginBatch();
+    testWad->createFile("/Gl/bt/view");
+    ASSERT_EQ(testWad->writeToFile("/Gl/bt/view", "pending", 7), 7);
+    std::string_view pendingView, committedView;
+    ASSERT_EQ(testWad->getContentsView("/Gl/bt/view", &pendingView), 7);
+    ASSERT_EQ(pendingView, "pending");
+    ASSERT_TRUE(testWad->commit());
+    ASSERT_EQ(testWad->getContentsView("/Gl/bt/view", &committedView), 7);
+    ASSERT_EQ(committedView, "pending");
+    ASSERT_NE(committedView.data(), pendingView.data());
+    delete testWad;
+
+    Wad* reloaded = Wad::loadWad(wad_path);
+    std::vector<std::string> entries;
+    ASSERT_EQ(reloaded->getDirectory("/Gl/bt", &entries), 202);
+    ASSERT_EQ(entries[200], "late");
+    ASSERT_EQ(reloaded->getContents("/Gl/bt/f199", buffer, sizeof(buffer)), 11);
+    ASSERT_EQ(memcmp(buffer, "/Gl/bt/f199", 11), 0);
+    delete reloaded;
+}
+
+TEST(MyWriteTests, pendingLumpGrowsAcrossWrites){
+    std::string wad_path = setupWorkspace();
+    Wad* testWad = Wad::loadWad(wad_path);
+
+    // Within a batch, a lump is written in chunks the way wadfs receives it
+    testWad->beginBatch();
+    testWad->createFile("/Gl/ad/big");
+    std::string chunk(5000, 'x');
+    for (int i = 0; i < 4; ++i) {
+        chunk[0] = 'a' + i;
+        ASSERT_EQ(testWad->writeToFile("/Gl/ad/big", chunk.data(), chunk.size(), i * chunk.size()), (int)chunk.size());
+    }
+    ASSERT_EQ(testWad->getSize("/Gl/ad/big"), 20000);
+
+    // Only a write that continues at the end is accepted
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/big", "y", 1, 100), 0);
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/big", "y", 1, 20001), 0);
+    ASSERT_TRUE(testWad->commit());
+
+    // A commit can land between two chunks (wadfs flushes whenever any file is closed): the committed
+    // lump keeps growing, moved to the end of the file
+    testWad->beginBatch();
+    testWad->createFile("/Gl/ad/two");
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/two", chunk.data(), chunk.size()), (int)chunk.size());
+    ASSERT_TRUE(testWad->flush());
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/two", "z", 1, chunk.size()), 1);
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/big", "y", 1, 20000), 1);
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/big", "y", 1, 100), 0);
+    ASSERT_TRUE(testWad->commit());
+    delete testWad;
+
+    // So do lumps that came with the archive, and the lump cache drops the old copy
+    WadOptions cached;
+    cached.useMmap = false;
+    cached.lumpCacheBytes = 1 << 20;
+    testWad = Wad::loadWad(wad_path, cached);
+    std::vector<char> cake(29869);
+    ASSERT_EQ(testWad->getContents("/Gl/ad/os/cake.jpg", cake.data(), cake.size()), 29869);
+    ASSERT_EQ(testWad->getContents("/Gl/ad/os/cake.jpg", cake.data(), cake.size()), 29869);
+    ASSERT_EQ(testWad->getCacheStats().hits, 1u);
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/os/cake.jpg", "tail", 4, 29869), 4);
+    ASSERT_EQ(testWad->getCacheStats().bytes, 0u);
+    char tail[4];
+    ASSERT_EQ(testWad->getContents("/Gl/ad/os/cake.jpg", tail, 4, 29869), 4);
+    ASSERT_EQ(memcmp(tail, "tail", 4), 0);
+    delete testWad;
+
+    Wad* reloaded = Wad::loadWad(wad_path);
+    std::vector<char> buffer(20001);
+    ASSERT_EQ(reloaded->getContents("/Gl/ad/big", buffer.data(), buffer.size()), 20001);
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_EQ(buffer[i * 5000], 'a' + i);
+        ASSERT_EQ(buffer[i * 5000 + 1], 'x');
+    }
+    ASSERT_EQ(buffer[20000], 'y');
+    ASSERT_EQ(reloaded->getSize("/Gl/ad/two"), (int)chunk.size() + 1);
+    ASSERT_EQ(reloaded->getContents("/Gl/ad/two", buffer.data(), 2, chunk.size() - 1), 2);
+    ASSERT_EQ(buffer[1], 'z');
+    std::vector<char> moved(29873);
+    ASSERT_EQ(reloaded->getContents("/Gl/ad/os/cake.jpg", moved.data(), moved.size()), 29873);
+    ASSERT_TRUE(std::equal(cake.begin(), cake.end(), moved.begin()));
+    ASSERT_EQ(memcmp(moved.data() + 29869, "tail", 4), 0);
+    delete reloaded;
+}
+
+TEST(MyWriteTests, heldLumpsWaitForTheirWriter){
+    // Two files copied at once through one batch, the way wadfs receives them
+    std::string wad_path = setupWorkspace();
+    Wad* testWad = Wad::loadWad(wad_path);
+    testWad->beginBatch();
+    testWad->createFile("/Gl/ad/one");
+    testWad->createFile("/Gl/ad/two");
+    WadHandle one = testWad->resolve("/Gl/ad/one");
+    WadHandle two = testWad->resolve("/Gl/ad/two");
+    testWad->beginWrite(one);
+    testWad->beginWrite(two);
+    std::string chunk(5000, 'x');
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/one", chunk.data(), chunk.size()), (int)chunk.size());
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/two", chunk.data(), chunk.size()), (int)chunk.size());
+
+    // Closing one commits it, and two's first half stays out of the archive
+    struct stat before, after;
+    ASSERT_EQ(stat(wad_path.c_str(), &before), 0);
+    testWad->endWrite(one);
+    ASSERT_TRUE(testWad->flush());
+    ASSERT_EQ(stat(wad_path.c_str(), &after), 0);
+    ASSERT_LT(after.st_size - before.st_size, 2 * (off_t)chunk.size());
+    Wad* reader = Wad::loadWad(wad_path);
+    ASSERT_EQ(reader->getSize("/Gl/ad/one"), 5000);
+    ASSERT_EQ(reader->getSize("/Gl/ad/two"), 0);
+    delete reader;
+
+    // An fsync of two writes it while it stays held; the next chunk moves it
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/two", "y", 1, 5000), 1);
+    ASSERT_TRUE(testWad->flush(two));
+    reader = Wad::loadWad(wad_path);
+    ASSERT_EQ(reader->getSize("/Gl/ad/two"), 5001);
+    delete reader;
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/two", "z", 1, 5001), 1);
+    ASSERT_TRUE(testWad->flush());
+    reader = Wad::loadWad(wad_path);
+    ASSERT_EQ(reader->getSize("/Gl/ad/two"), 5001);
+    delete reader;
+
+    testWad->endWrite(two);
+    ASSERT_TRUE(testWad->commit());
+    delete testWad;
+
+    Wad* reloaded = Wad::loadWad(wad_path);
+    ASSERT_EQ(reloaded->getSize("/Gl/ad/one"), 5000);
+    ASSERT_EQ(reloaded->getSize("/Gl/ad/two"), 5002);
+    char tail[2];
+    ASSERT_EQ(reloaded->getContents("/Gl/ad/two", tail, 2, 5000), 2);
+    ASSERT_EQ(memcmp(tail, "yz", 2), 0);
+    delete reloaded;
+}
+
+TEST(MyWriteTests, commitNeverOverwritesLiveTable){
+    std::string wad_path = setupWorkspace();
+    auto readFile = [&]() {
+        std::ifstream in(wad_path, std::ios::binary);
+        return std::vector<char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    };
+    std::vector<char> before = readFile();
+    uint32_t count, tableOffset;
+    memcpy(&count, before.data() + 4, 4);
+    memcpy(&tableOffset, before.data() + 8, 4);
+
+    Wad* testWad = Wad::loadWad(wad_path);
+    testWad->createFile("/Gl/ad/cow");
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/cow", "moo", 3), 3);
+    delete testWad;
+
+    // Everything the old header pointed at is byte-for-byte intact, so a crash before the header
+    // switch would have left the old archive; the new table lives past the old end of file
+    std::vector<char> after = readFile();
+    ASSERT_GT(after.size(), before.size());
+    ASSERT_TRUE(std::equal(before.begin() + 12, before.end(), after.begin() + 12));
+    uint32_t newCount, newOffset;
+    memcpy(&newCount, after.data() + 4, 4);
+    memcpy(&newOffset, after.data() + 8, 4);
+    ASSERT_EQ(newCount, count + 1);
+    ASSERT_GE(newOffset, before.size());
+    ASSERT_LE(newOffset + newCount * 16, after.size());
+}
+
+TEST(MyWriteTests, tableSlotsAreReusedNearSizeLimit){
+    // sample1's lumps, with its table moved up against the 4 GiB offset limit of the format (the gap
+    // is a hole in a sparse file) so that only 64 KiB are left for edits
+    std::string wad_path = setupWorkspace();
+    std::ifstream in(wad_path, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    uint32_t count, tableOffset;
+    memcpy(&count, bytes.data() + 4, 4);
+    memcpy(&tableOffset, bytes.data() + 8, 4);
+    uint32_t movedOffset = UINT32_MAX - 65535 - count * 16;
+
+    const std::string limit_path = "./testfiles/limit.wad";
+    {
+        std::ofstream out(limit_path, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), tableOffset);
+        out.seekp(movedOffset);
+        out.write(bytes.data() + tableOffset, count * 16);
+        out.seekp(8);
+        out.write(reinterpret_cast<const char*>(&movedOffset), 4);
+    }
+
+    // Far more single edits than 64 KiB of appended tables would allow; after the first few commits
+    // the tables alternate between two slots and the file stops growing
+    Wad* testWad = Wad::loadWad(limit_path);
+    ASSERT_EQ(testWad->getSize("/Gl/ad/os/cake.jpg"), 29869);
+    struct stat early, late;
+    for (int i = 0; i < 200; ++i) {
+        testWad->createFile("/Gl/ad/s" + std::to_string(i));
+        if (i == 2) {
+            ASSERT_EQ(stat(limit_path.c_str(), &early), 0);
+        }
+    }
+    ASSERT_EQ(stat(limit_path.c_str(), &late), 0);
+    ASSERT_EQ(late.st_size, early.st_size);
+    ASSERT_LE(late.st_size, (off_t)UINT32_MAX);
+
+    // Data that would cross the limit is refused, and the archive keeps its last committed state
+    testWad->createFile("/Gl/ad/big");
+    std::vector<char> big(128 * 1024, 'b');
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/big", big.data(), big.size()), 0);
+    ASSERT_EQ(testWad->getSize("/Gl/ad/big"), 0);
+
+    // The refused write was taken back, so it does not hold up the edits after it
+    testWad->createFile("/Gl/ad/after");
+    ASSERT_TRUE(testWad->isContent("/Gl/ad/after"));
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/after", "after", 5), 5);
+
+    // Entries are refused too once the table outgrows what is left, and leave nothing behind
+    std::vector<std::string> entries;
+    int created = 0;
+    for (; created < 10000; ++created) {
+        std::string path = "/Gl/ad/t" + std::to_string(created);
+        testWad->createFile(path);
+        if (!testWad->isContent(path))
+            break;
+    }
+    ASSERT_LT(created, 10000);
+    ASSERT_EQ(testWad->getDirectory("/Gl/ad", &entries), 203 + created);
+    testWad->createDirectory("/Gl/ad/zz");
+    ASSERT_FALSE(testWad->isDirectory("/Gl/ad/zz"));
+    // An append that would move a lump stays where it was
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/os/cake.jpg", "x", 1, 29869), 0);
+    ASSERT_EQ(testWad->getSize("/Gl/ad/os/cake.jpg"), 29869);
+    std::vector<char> cake(29869);
+    ASSERT_EQ(testWad->getContents("/Gl/ad/os/cake.jpg", cake.data(), cake.size()), 29869);
+    ASSERT_EQ(testWad->getSize("/Gl/ad/after"), 5);
+    delete testWad;
+
+    Wad* reloaded = Wad::loadWad(limit_path);
+    entries.clear();
+    ASSERT_EQ(reloaded->getDirectory("/Gl/ad", &entries), 203 + created);
+    ASSERT_EQ(entries[200], "s199");
+    ASSERT_EQ(entries[202], "after");
+    ASSERT_EQ(reloaded->getSize("/Gl/ad/big"), 0);
+    ASSERT_EQ(reloaded->getSize("/Gl/ad/after"), 5);
+    ASSERT_EQ(reloaded->getSize("/Gl/ad/os/cake.jpg"), 29869);
+    delete reloaded;
+    remove(limit_path.c_str());
+}
+
+TEST(MyWriteTests, commitsRarelyRemapArchive){
+    std::string wad_path = setupWorkspace();
+    char resolved[PATH_MAX];
+    ASSERT_NE(realpath(wad_path.c_str(), resolved), nullptr);
+    auto countMappings = [&]() {
+        std::ifstream maps("/proc/self/maps");
+        int count = 0;
+        for (std::string line; std::getline(maps, line); )
+            count += line.find(resolved) != std::string::npos;
+        return count;
+    };
+
+    Wad* testWad = Wad::loadWad(wad_path);
+    ASSERT_TRUE(testWad->isMapped());
+    for (int i = 0; i < 40; ++i) {
+        std::string name = "/Gl/ad/m" + std::to_string(i);
+        testWad->createFile(name);
+        ASSERT_EQ(testWad->writeToFile(name, name.c_str(), name.size()), (int)name.size());
+    }
+
+    // Each of the 80 commits grew the file, but only a doubling of it needs a new mapping
+    ASSERT_LE(countMappings(), 3);
+
+    // Committed lumps are read back through the mapping, including the ones past the first mapped size
+    ASSERT_TRUE(testWad->isMapped());
+    for (int i = 0; i < 40; ++i) {
+        std::string name = "/Gl/ad/m" + std::to_string(i);
+        std::string_view view;
+        ASSERT_EQ(testWad->getContentsView(name, &view), (int)name.size());
+        ASSERT_EQ(view, name);
+    }
+    delete testWad;
+    ASSERT_EQ(countMappings(), 0);
+}
+
+TEST(MyWriteTests, createdEntriesKeepInsertionOrder){
+    std::string wad_path = setupWorkspace();
+    Wad* testWad = Wad::loadWad(wad_path);
+
+    testWad->beginBatch();
+    testWad->createDirectory("/Gl/d1");
+    testWad->createDirectory("/Gl/d2");
+    testWad->createFile("/Gl/f");
+    // A flat namespace large enough that a per-insert scan of the children would dominate
+    testWad->createDirectory("/Gl/fl");
+    for (int i = 0; i < 20000; ++i)
+        testWad->createFile("/Gl/fl/" + std::to_string(i));
+    ASSERT_TRUE(testWad->commit());
+
+    std::vector<std::string> entries;
+    testWad->getDirectory("/Gl", &entries);
+    ASSERT_EQ(entries, std::vector<std::string>({"ad", "d1", "d2", "f", "fl"}));
+    delete testWad;
+
+    Wad* reloaded = Wad::loadWad(wad_path);
+    entries.clear();
+    reloaded->getDirectory("/Gl", &entries);
+    ASSERT_EQ(entries, std::vector<std::string>({"ad", "d1", "d2", "f", "fl"}));
+    entries.clear();
+    ASSERT_EQ(reloaded->getDirectory("/Gl/fl", &entries), 20000);
+    ASSERT_EQ(entries.front(), "0");
+    ASSERT_EQ(entries.back(), "19999");
+    delete reloaded;
+}
+
+// Lists every path under dir with its size (-1 for directories), depth first, in directory order
+void dumpTree(Wad* wad, const string& dir, vector<string>* out) {
+    vector<string> entries;
+    wad->getDirectory(dir, &entries);
+    for (const string& entry : entries) {
+        string path = (dir == "/" ? "" : dir) + "/" + entry;
+        out->push_back(path + ":" + to_string(wad->getSize(path)));
+        if (wad->isDirectory(path))
+            dumpTree(wad, path, out);
+    }
+}
+
+TEST(MyReadTests, lazyTreeMatchesEagerTree){
+    std::string wad_path = setupWorkspace();
+    Wad* eager = Wad::loadWad(wad_path);
+    std::vector<std::string> expected;
+    dumpTree(eager, "/", &expected);
+    delete eager;
+
+    WadOptions lazy;
+    lazy.lazyTree = true;
+    for (bool useMmap : {true, false}) {
+        lazy.useMmap = useMmap;
+
+        // Deep lookups before any listing build just the directories on the way
+        Wad* testWad = Wad::loadWad(wad_path, lazy);
+        ASSERT_TRUE(testWad->isContent("/Gl/ad/os/cake.jpg"));
+        ASSERT_EQ(testWad->getSize("/Gl/ad/os/cake.jpg"), 29869);
+        ASSERT_TRUE(testWad->isDirectory("/E1M0"));
+        ASSERT_FALSE(testWad->resolve("/Gl/ad/missing").isValid());
+
+        std::vector<std::string> actual;
+        dumpTree(testWad, "/", &actual);
+        ASSERT_EQ(actual, expected);
+        delete testWad;
+    }
+
+    // Edits in a lazy tree build the rest of it before the table is rewritten
+    lazy.useMmap = true;
+    Wad* testWad = Wad::loadWad(wad_path, lazy);
+    testWad->createFile("/Gl/ad/lz");
+    ASSERT_EQ(testWad->writeToFile("/Gl/ad/lz", "lazy", 4), 4);
+    delete testWad;
+
+    Wad* reloaded = Wad::loadWad(wad_path);
+    std::vector<std::string> actual;
+    dumpTree(reloaded, "/", &actual);
+    auto added = std::find(actual.begin(), actual.end(), "/Gl/ad/lz:4");
+    ASSERT_NE(added, actual.end());
+    actual.erase(added);
+    ASSERT_EQ(actual, expected);
+    delete reloaded;
+}
+
+TEST(MyReadTests, indexCacheReopensSameTree){
+    std::string wad_path = setupWorkspace();
+    std::string index_path = wad_path + ".idx";
+    unlink(index_path.c_str());
+
+    WadOptions cached;
+    cached.indexCachePath = index_path;
+    std::vector<std::string> expected, actual;
+
+    Wad* testWad = Wad::loadWad(wad_path, cached);
+    dumpTree(testWad, "/", &expected);
+    delete testWad;
+    struct stat st;
+    ASSERT_EQ(stat(index_path.c_str(), &st), 0);
+
+    // Served from the index
+    testWad = Wad::loadWad(wad_path, cached);
+    dumpTree(testWad, "/", &actual);
+    ASSERT_EQ(actual, expected);
+    char buffer[16];
+    ASSERT_EQ(testWad->getContents("/E1M0/01.txt", buffer, sizeof(buffer)), std::min<int>(sizeof(buffer), testWad->getSize("/E1M0/01.txt")));
+
+    // Editing the WAD makes the index stale; the next load parses and rewrites it
+    testWad->createFile("/Gl/ad/ix");
+    delete testWad;
+    testWad = Wad::loadWad(wad_path, cached);
+    ASSERT_TRUE(testWad->isContent("/Gl/ad/ix"));
+    delete testWad;
+
+    // A damaged index is ignored
+    ASSERT_EQ(truncate(index_path.c_str(), st.st_size / 2), 0);
+    testWad = Wad::loadWad(wad_path, cached);
+    ASSERT_TRUE(testWad->isContent("/Gl/ad/ix"));
+    ASSERT_TRUE(testWad->isContent("/Gl/ad/os/cake.jpg"));
+    uint32_t cake = testWad->resolve("/Gl/ad/os/cake.jpg").index;
+    expected.clear();
+    dumpTree(testWad, "/", &expected);
+    delete testWad;
+
+    // So is one that is intact in size and bounds but links a node to itself, which would make every
+    // listing of its directory endless
+    std::fstream index(index_path, std::ios::in | std::ios::out | std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(index)), std::istreambuf_iterator<char>());
+    auto node = std::search(bytes.begin(), bytes.end(), "cake.jpg", "cake.jpg" + 8);
+    ASSERT_NE(node, bytes.end());
+    index.seekp((node - bytes.begin()) + offsetof(WadNode, nextSibling));
+    index.write(reinterpret_cast<const char*>(&cake), sizeof(cake));
+    index.close();
+
+    testWad = Wad::loadWad(wad_path, cached);
+    actual.clear();
+    dumpTree(testWad, "/", &actual);
+    ASSERT_EQ(actual, expected);
+    delete testWad;
+
+    // And one whose path table is dropped while its size field claims 2^62 slots, which a size check
+    // in 64-bit arithmetic would see as 0 bytes. The header's last three fields are the node count,
+    // the table size and the child count, just before the root node.
+    std::ifstream rewritten(index_path, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(rewritten), std::istreambuf_iterator<char>());
+    const char rootNode[9] = {'/', 0, 0, 0, 0, 0, 0, 0, 1};
+    size_t nodesStart = std::search(bytes.begin(), bytes.end(), rootNode, rootNode + 9) - bytes.begin();
+    ASSERT_LT(nodesStart, bytes.size());
+    uint64_t nodeCount, hugeTable = 1ull << 62;
+    memcpy(&nodeCount, bytes.data() + nodesStart - 24, 8);
+    index.open(index_path, std::ios::in | std::ios::out | std::ios::binary);
+    index.seekp(nodesStart - 16);
+    index.write(reinterpret_cast<const char*>(&hugeTable), sizeof(hugeTable));
+    index.close();
+    ASSERT_EQ(truncate(index_path.c_str(), nodesStart + nodeCount * sizeof(WadNode)), 0);
+
+    testWad = Wad::loadWad(wad_path, cached);
+    actual.clear();
+    dumpTree(testWad, "/", &actual);
+    ASSERT_EQ(actual, expected);
+    delete testWad;
+
+    // An index from a build that shaped the tree differently (an older version, stored right after
+    // the 8-byte magic) is replaced rather than served
+    uint32_t version, oldVersion = 1;
+    index.open(index_path, std::ios::in | std::ios::out | std::ios::binary);
+    index.seekg(8);
+    index.read(reinterpret_cast<char*>(&version), sizeof(version));
+    ASSERT_GT(version, 1u);
+    index.seekp(8);
+    index.write(reinterpret_cast<const char*>(&oldVersion), sizeof(oldVersion));
+    index.close();
+    delete Wad::loadWad(wad_path, cached);
+    uint32_t rewrittenVersion = 0;
+    std::ifstream(index_path, std::ios::binary).seekg(8).read(reinterpret_cast<char*>(&rewrittenVersion), 4);
+    ASSERT_EQ(rewrittenVersion, version);
+    unlink(index_path.c_str());
+}
+
+// Writes a WAD whose lumps have the given names, each holding its own name as data
+void writeNamedWad(const string& path, const vector<string>& names) {
+    ofstream out(path, ios::binary | ios::trunc);
+    vector<char> table;
+    uint32_t offset = 12;
+    out.write("PWAD\0\0\0\0\0\0\0\0", 12);
+    for (const string& name : names) {
+        bool marker = name.find("_START") != string::npos || name.find("_END") != string::npos;
+        uint32_t size = marker ? 0 : name.size();
+        out.write(name.data(), size);
+        char entry[16] = {0};
+        memcpy(entry, &offset, 4);
+        memcpy(entry + 4, &size, 4);
+        memcpy(entry + 8, name.data(), min<size_t>(name.size(), 8));
+        table.insert(table.end(), entry, entry + 16);
+        offset += size;
+    }
+    out.write(table.data(), table.size());
+    uint32_t header[2] = {static_cast<uint32_t>(names.size()), offset};
+    out.seekp(4);
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+}
+
+TEST(MyReadTests, mapBlocksOfEveryFormat){
+    const std::string wad_path = "./testfiles/maps.wad";
+    writeNamedWad(wad_path, {
+        "PLAYPAL",
+        // Doom II with Hexen extras and glBSP nodes
+        "MAP01", "THINGS", "LINEDEFS", "SIDEDEFS", "VERTEXES", "SEGS", "SSECTORS", "NODES", "SECTORS",
+        "REJECT", "BLOCKMAP", "BEHAVIOR", "GL_MAP01", "GL_VERT", "GL_SEGS", "GL_SSECT", "GL_NODES",
+        // UDMF: anything between TEXTMAP and ENDMAP is part of the map
+        "MAP02", "TEXTMAP", "ZNODES", "DIALOGUE", "ENDMAP",
+        // A short classic map ends at the first lump that is not a map lump
+        "E1M1", "THINGS", "LINEDEFS",
+        "COLORMAP",
+        "F_START", "MAP03", "TEXTMAP", "ENDMAP", "FLAT1", "F_END",
+        // Unrecognized contents keep the fixed 10-lump layout
+        "E1M0", "01.txt", "02.txt", "03.txt", "04.txt", "05.txt", "06.txt", "07.txt", "08.txt", "09.txt",
+        "10.txt", "ENDOOM",
+    });
+
+    WadOptions lazy;
+    lazy.lazyTree = true;
+    std::vector<std::string> expected;
+    for (bool useLazy : {false, true}) {
+        Wad* testWad = useLazy ? Wad::loadWad(wad_path, lazy) : Wad::loadWad(wad_path);
+        std::vector<std::string> entries;
+        testWad->getDirectory("/", &entries);
+        ASSERT_EQ(entries, std::vector<std::string>({"PLAYPAL", "MAP01", "MAP02", "E1M1", "COLORMAP", "F", "E1M0", "ENDOOM"}));
+
+        entries.clear();
+        ASSERT_EQ(testWad->getDirectory("/MAP01", &entries), 16);
+        ASSERT_EQ(entries.back(), "GL_NODES");
+        entries.clear();
+        ASSERT_EQ(testWad->getDirectory("/MAP02", &entries), 4);
+        ASSERT_EQ(entries, std::vector<std::string>({"TEXTMAP", "ZNODES", "DIALOGUE", "ENDMAP"}));
+        entries.clear();
+        ASSERT_EQ(testWad->getDirectory("/E1M1", &entries), 2);
+        entries.clear();
+        ASSERT_EQ(testWad->getDirectory("/F/MAP03", &entries), 2);
+        ASSERT_TRUE(testWad->isContent("/F/FLAT1"));
+        entries.clear();
+        ASSERT_EQ(testWad->getDirectory("/E1M0", &entries), 10);
+
+        char buffer[8];
+        ASSERT_EQ(testWad->getContents("/MAP02/DIALOGUE", buffer, 8), 8);
+        ASSERT_EQ(memcmp(buffer, "DIALOGUE", 8), 0);
+
+        std::vector<std::string> tree;
+        dumpTree(testWad, "/", &tree);
+        if (useLazy) {
+            ASSERT_EQ(tree, expected);
+        }
+        expected = tree;
+
+        // MAPxx is a marker name, so it cannot be created as a file
+        testWad->createFile("/MAP04");
+        ASSERT_FALSE(testWad->isContent("/MAP04"));
+        delete testWad;
+    }
+    unlink(wad_path.c_str());
+}
+
+TEST(MyReadTests, lumpCountIsBoundedByFileSize){
+    // A bare header claiming two billion lumps, and one whose table is cut short after one descriptor
+    const std::string wad_path = "./testfiles/huge_count.wad";
+    writeNamedWad(wad_path, {"ONE", "TWO"});
+    uint32_t header[2] = {0x7FFFFFF0, 12};
+    {
+        std::fstream out(wad_path, std::ios::in | std::ios::out | std::ios::binary);
+        out.seekp(4);
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    }
+    ASSERT_EQ(truncate(wad_path.c_str(), 12), 0);
+
+    WadOptions buffered;
+    buffered.useMmap = false;
+    for (const WadOptions& options : {WadOptions(), buffered}) {
+        Wad* testWad = Wad::loadWad(wad_path, options);
+        std::vector<std::string> entries;
+        ASSERT_EQ(testWad->getDirectory("/", &entries), 0);
+        delete testWad;
+    }
+
+    writeNamedWad(wad_path, {"ONE", "TWO"});
+    std::ifstream in(wad_path, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(truncate(wad_path.c_str(), bytes.size() - 16), 0);
+    for (const WadOptions& options : {WadOptions(), buffered}) {
+        Wad* testWad = Wad::loadWad(wad_path, options);
+        std::vector<std::string> entries;
+        ASSERT_EQ(testWad->getDirectory("/", &entries), 1);
+        ASSERT_EQ(entries[0], "ONE");
+        delete testWad;
+    }
+    remove(wad_path.c_str());
+}
+
+TEST(MyWriteTests, entriesAfterMapKeepTheirPlace){
+    // New entries land right after the map's lumps, so one named like a map lump would reload inside it
+    const std::string wad_path = "./testfiles/map_tail.wad";
+    writeNamedWad(wad_path, {"PLAYPAL", "MAP01", "THINGS", "LINEDEFS"});
+
+    Wad* testWad = Wad::loadWad(wad_path);
+    testWad->createFile("/SCRIPTS");
+    testWad->createFile("/GL_MAP01");
+    testWad->createDirectory("/GL");
+    ASSERT_FALSE(testWad->isContent("/SCRIPTS"));
+    ASSERT_FALSE(testWad->isContent("/GL_MAP01"));
+    ASSERT_FALSE(testWad->isDirectory("/GL"));
+
+    testWad->createFile("/OTHER");
+    ASSERT_EQ(testWad->writeToFile("/OTHER", "data", 4), 4);
+    // Once another entry follows the map, map lump names are ordinary again
+    testWad->createFile("/SCRIPTS");
+    ASSERT_TRUE(testWad->isContent("/SCRIPTS"));
+    std::vector<std::string> expected;
+    dumpTree(testWad, "/", &expected);
+    delete testWad;
+
+    Wad* reloaded = Wad::loadWad(wad_path);
+    std::vector<std::string> actual;
+    dumpTree(reloaded, "/", &actual);
+    ASSERT_EQ(actual, expected);
+    std::vector<std::string> entries;
+    ASSERT_EQ(reloaded->getDirectory("/", &entries), 4);
+    ASSERT_EQ(entries, std::vector<std::string>({"PLAYPAL", "MAP01", "OTHER", "SCRIPTS"}));
+    ASSERT_EQ(reloaded->getSize("/OTHER"), 4);
+    delete reloaded;
+
+    // A map of unrecognized lumps takes the next ten descriptors, whatever they are called
+    writeNamedWad(wad_path, {"E1M1", "01.txt", "02.txt"});
+    testWad = Wad::loadWad(wad_path);
+    testWad->createFile("/OTHER");
+    ASSERT_FALSE(testWad->isContent("/OTHER"));
+    delete testWad;
+    remove(wad_path.c_str());
+}
+
+TEST(MyReadTests, readDirectoryResumesFromOffsets){
+    std::string wad_path = setupWorkspace();
+    Wad* testWad = Wad::loadWad(wad_path);
+    testWad->createDirectory("/Gl/rd");
+    for (int i = 0; i < 25; ++i)
+        testWad->createFile("/Gl/rd/f" + std::to_string(i));
+
+    for (const char* dir : {"/", "/Gl", "/Gl/rd", "/E1M0"}) {
+        std::vector<std::string> expected;
+        testWad->getDirectory(dir, &expected);
+
+        // Page through three entries at a time, the way FUSE hands back a full buffer
+        std::vector<std::string> paged;
+        std::vector<WadHandle> handles;
+        WadHandle handle = testWad->resolve(dir);
+        uint64_t offset = 0;
+        int read;
+        do {
+            int taken = 0;
+            read = testWad->readDirectory(handle, offset, [&](std::string_view name, WadHandle child, uint64_t next) {
+                if (taken == 3)
+                    return false;
+                paged.emplace_back(name);
+                handles.push_back(child);
+                offset = next;
+                ++taken;
+                return true;
+            });
+            ASSERT_GE(read, 0);
+        } while (read == 3);
+        ASSERT_EQ(paged, expected);
+        for (size_t i = 0; i < paged.size(); ++i)
+            ASSERT_EQ(handles[i].index, testWad->resolve(std::string(dir) + "/" + paged[i]).index);
+    }
+
+    auto ignore = [](std::string_view, WadHandle, uint64_t) { return true; };
+    ASSERT_EQ(testWad->readDirectory(testWad->resolve("/Gl/ad/os/cake.jpg"), 0, ignore), -1);
+    ASSERT_EQ(testWad->readDirectory(testWad->resolve("/Gl"), testWad->resolve("/E1M0").index + 1, ignore), -1);
+    delete testWad;
+}
+
+TEST(MyWriteTests, existingNamesAreNotCreatedAgain){
+    std::string wad_path = setupWorkspace();
+    std::vector<std::string> expected, actual;
+
+    Wad* testWad = Wad::loadWad(wad_path);
+    dumpTree(testWad, "/", &expected);
+
+    // Directories and files, over either kind of existing entry
+    testWad->createDirectory("/Gl");
+    testWad->createDirectory("/Gl/ad");
+    testWad->createDirectory("/mp.txt");
+    testWad->createFile("/mp.txt");
+    testWad->createFile("/Gl/ad");
+    testWad->createFile("/Gl/ad/os/cake.jpg");
+    dumpTree(testWad, "/", &actual);
+    ASSERT_EQ(actual, expected);
+    delete testWad;
+
+    // Nothing reached the file either: the original entries still resolve after a reload
+    Wad* reloaded = Wad::loadWad(wad_path);
+    actual.clear();
+    dumpTree(reloaded, "/", &actual);
+    ASSERT_EQ(actual, expected);
+    ASSERT_EQ(reloaded->getSize("/Gl/ad/os/cake.jpg"), 29869);
+    delete reloaded;
+}
+
+TEST(MyWriteTests, namespaceMarkersOnlyInDescriptorTable){
+    std::string wad_path = setupWorkspace();
+    Wad* testWad = Wad::loadWad(wad_path);
+    testWad->createDirectory("/Gl/nm");
+    testWad->createFile("/Gl/nm/in");
+
+    // Markers are not tree entries: not listed, not resolvable, not creatable as files
+    ASSERT_FALSE(testWad->resolve("/Gl/nm_START").isValid());
+    ASSERT_FALSE(testWad->resolve("/Gl/nm_END").isValid());
+    int listed = testWad->readDirectory(testWad->resolve("/Gl"), 0, [](std::string_view, WadHandle, uint64_t) { return true; });
+    ASSERT_EQ(listed, 2);
+    testWad->createFile("/Gl/nm/ab_END");
+    ASSERT_FALSE(testWad->resolve("/Gl/nm/ab_END").isValid());
+    delete testWad;
+
+    // The table brackets the new namespace with its markers
+    std::ifstream in(wad_path, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    uint32_t count, tableOffset;
+    memcpy(&count, bytes.data() + 4, 4);
+    memcpy(&tableOffset, bytes.data() + 8, 4);
+    std::vector<std::string> names;
+    for (uint32_t i = 0; i < count; ++i) {
+        const char* name = bytes.data() + tableOffset + i * 16 + 8;
+        names.emplace_back(name, strnlen(name, 8));
+    }
+    auto start = std::find(names.begin(), names.end(), "nm_START");
+    ASSERT_NE(start, names.end());
+    ASSERT_EQ(*(start + 1), "in");
+    ASSERT_EQ(*(start + 2), "nm_END");
+    ASSERT_EQ(*(start + 3), "Gl_END");
+}
+
+TEST(MyReadTests, directoryEntriesCarryTypeAndSize){
+    std::string wad_path = setupWorkspace();
+    Wad* testWad = Wad::loadWad(wad_path);
+
+    for (const char* dir : {"/", "/Gl/ad", "/E1M0"}) {
+        std::vector<WadEntry> entries;
+        std::vector<std::string> names;
+        testWad->getDirectory(dir, &names);
+        ASSERT_EQ(testWad->getDirectoryEntries(dir, &entries), (int)names.size());
+
+        for (size_t i = 0; i < entries.size(); ++i) {
+            std::string path = std::string(dir == std::string("/") ? "" : dir) + "/" + names[i];
+            ASSERT_EQ(entries[i].name, names[i]);
+            ASSERT_EQ(entries[i].handle.index, testWad->resolve(path).index);
+            ASSERT_EQ(entries[i].size, testWad->getSize(path));
+            ASSERT_EQ(entries[i].type == WadEntryType::File, testWad->isContent(path));
+        }
+    }
+
+    std::vector<WadEntry> root;
+    testWad->getDirectoryEntries("/", &root);
+    ASSERT_EQ(root[0].name, "E1M0");
+    ASSERT_EQ(root[0].type, WadEntryType::Map);
+    ASSERT_EQ(root[1].name, "Gl");
+    ASSERT_EQ(root[1].type, WadEntryType::Namespace);
+    ASSERT_EQ(testWad->getDirectoryEntries("/Gl/ad/os/cake.jpg", &root), -1);
+    delete testWad;
+}
+
+TEST(MyReadTests, lumpCacheServesRepeatReads){
+    std::string wad_path = setupWorkspace();
+    Wad* mapped = Wad::loadWad(wad_path);
+    std::vector<char> expected(29869);
+    ASSERT_EQ(mapped->getContents("/Gl/ad/os/cake.jpg", expected.data(), expected.size()), 29869);
+    ASSERT_EQ(mapped->getCacheStats().misses, 0u);
+    delete mapped;
+
+    WadOptions cached;
+    cached.useMmap = false;
+    cached.lumpCacheBytes = 1 << 20;
+    Wad* testWad = Wad::loadWad(wad_path, cached);
+
+    // Sequential chunks: the first loads the whole lump, the rest are hits
+    std::vector<char> actual(expected.size());
+    WadHandle cake = testWad->resolve("/Gl/ad/os/cake.jpg");
+    for (int offset = 0; offset < 29869; offset += 4096)
+        ASSERT_EQ(testWad->getContents(cake, actual.data() + offset, 4096, offset), std::min(4096, 29869 - offset));
+    ASSERT_EQ(actual, expected);
+
+    WadCacheStats stats = testWad->getCacheStats();
+    ASSERT_EQ(stats.misses, 1u);
+    ASSERT_EQ(stats.hits, 7u);
+    ASSERT_EQ(stats.bytes, 29869u);
+    ASSERT_EQ(stats.budget, size_t(1 << 20));
+    delete testWad;
+
+    // Lumps too big for the budget bypass the cache; the rest evict least recently used first
+    cached.lumpCacheBytes = 64;
+    testWad = Wad::loadWad(wad_path, cached);
+    cake = testWad->resolve("/Gl/ad/os/cake.jpg");
+    ASSERT_EQ(testWad->getContents(cake, actual.data(), 4096), 4096);
+    char buffer[16];
+    std::vector<std::string> maps;
+    testWad->getDirectory("/E1M0", &maps);
+    for (const std::string& lump : maps)
+        testWad->getContents("/E1M0/" + lump, buffer, sizeof(buffer));
+    // Only the seven map lumps of at most 16 bytes (a quarter of the budget) go through the cache
+    stats = testWad->getCacheStats();
+    ASSERT_EQ(stats.misses, 7u);
+    ASSERT_GT(stats.evictions, 0u);
+    ASSERT_LE(stats.bytes, 64u);
+    delete testWad;
+}
 
 // ==== HELPER TESTS ==== //
 
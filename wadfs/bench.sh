@@ -0,0 +1,61 @@
+#!/bin/bash
+# Throughput benchmark for a mounted archive: walks the tree with find and
+# streams every lump with cat, then copies files into the mount with cp,
+# once per pass and checks the copies against their source. The mount is of a
+# scratch copy, so the archive is not changed. Exits 1 if any copy went wrong.
+# Usage: ./bench.sh [wadfile] [passes] [files per pass] [KiB per file]
+
+WAD="${1:-../test-workspace/testfiles/sample1_copy.wad}"
+PASSES="${2:-3}"
+FILES="${3:-16}"
+KIB="${4:-1024}"
+FAILED=0
+SCRATCH="$(mktemp -d)"
+MOUNT="$SCRATCH/mnt"
+
+cleanup(){
+    fusermount -u "$MOUNT" 2> /dev/null
+    rm -rf "$SCRATCH"
+}
+trap cleanup EXIT
+
+mkdir "$MOUNT"
+cp "$WAD" "$SCRATCH/bench.wad"
+# Larger than one FUSE write request, so every copy arrives in several chunks
+head -c $((KIB * 1024)) /dev/urandom > "$SCRATCH/source"
+
+if ! ./wadfs "$SCRATCH/bench.wad" "$MOUNT" ; then
+    echo "Could not mount $WAD. Exiting."
+    exit 1
+fi
+
+BYTES=$(find "$MOUNT" -type f -exec cat {} + | wc -c)
+ENTRIES=$(find "$MOUNT" | wc -l)
+echo "Mounted $WAD: $ENTRIES entries, $BYTES bytes of lump data"
+
+for ((pass = 1; pass <= PASSES; pass++)); do
+    start=$(date +%s.%N)
+    find "$MOUNT" > /dev/null
+    mid=$(date +%s.%N)
+    find "$MOUNT" -type f -exec cat {} + > /dev/null
+    end=$(date +%s.%N)
+
+    # Namespace names are at most two characters
+    DIR="$MOUNT/$(printf 'W%d' "$pass")"
+    mkdir "$DIR"
+    for ((i = 0; i < FILES; i++)); do
+        cp "$SCRATCH/source" "$DIR/f$i" || { echo "pass $pass: copy $i failed"; FAILED=1; }
+    done
+    written=$(date +%s.%N)
+    for ((i = 0; i < FILES; i++)); do
+        cmp -s "$SCRATCH/source" "$DIR/f$i" || { echo "pass $pass: f$i does not match its source"; FAILED=1; }
+    done
+
+    awk -v p="$pass" -v n="$ENTRIES" -v b="$BYTES" -v f="$FILES" -v w="$((FILES * KIB * 1024))" \
+        -v s="$start" -v m="$mid" -v e="$end" -v c="$written" 'BEGIN {
+        printf "pass %d: find %.3fs (%.0f entries/s), cat %.3fs (%.1f MB/s), cp %.3fs (%.0f files/s, %.1f MB/s)\n",
+            p, m - s, n / (m - s), e - m, b / (e - m) / 1048576, c - e, f / (c - e), w / (c - e) / 1048576
+    }'
+done
+
+exit $FAILED
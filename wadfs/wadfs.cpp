@@ -0,0 +1,226 @@
+// WADFS_CPP
+
+// FUSE daemon that mounts a WAD archive through libWad.
+// Usage: ./wadfs [FUSE options] <wadfile> <mountpoint>
+// Runs multi-threaded unless -s is passed; a single Wad instance is shared by every FUSE worker
+// thread (see the concurrency notes in libWad/Wad.h).
+// Edits go through one libWad batch that stays open for the whole mount: they reach the archive
+// when a file opened for writing is released or fsynced, after each mkdir, and at unmount. Files
+// still open for writing are held back from those commits (see Wad::beginWrite).
+
+#define FUSE_USE_VERSION 26
+
+#include "../libWad/Wad.h"
+#include <fuse.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+// Largest request the kernel may send in one read/write; FUSE's default is 4 KiB for writes
+static const unsigned IO_SIZE = 128 * 1024;
+
+static Wad* getWad() {
+    return static_cast<Wad*>(fuse_get_context()->private_data);
+}
+
+static void* wadfs_init(struct fuse_conn_info *conn) {
+    conn->max_readahead = IO_SIZE;
+    conn->max_write = IO_SIZE;
+    conn->want |= FUSE_CAP_BIG_WRITES;
+    return getWad();
+}
+
+static int wadfs_getattr(const char *path, struct stat *st) {
+    Wad* wad = getWad();
+    memset(st, 0, sizeof(*st));
+
+    WadHandle handle = wad->resolve(path);
+    if (wad->isDirectory(handle)) {
+        st->st_mode = S_IFDIR | 0777;
+        st->st_nlink = 2;
+        return 0;
+    }
+    if (wad->isContent(handle)) {
+        st->st_mode = S_IFREG | 0777;
+        st->st_nlink = 1;
+        st->st_size = wad->getSize(handle);
+        return 0;
+    }
+    return -ENOENT;
+}
+
+// Directory handles carry the resolved node so readdir does not look the path up again
+static int wadfs_opendir(const char *path, struct fuse_file_info *fi) {
+    Wad* wad = getWad();
+    WadHandle handle = wad->resolve(path);
+    if (!handle.isValid())
+        return -ENOENT;
+    if (!wad->isDirectory(handle))
+        return -ENOTDIR;
+    fi->fh = handle.index;
+    return 0;
+}
+
+// Offset-based readdir: FUSE offset 1 follows ".", 2 follows "..", and 2 + n resumes libWad's listing at its 
+// cursor offset n. Names go straight from the tree into FUSE's buffer, and a full buffer just ends this 
+// batch; the kernel calls again with the offset of the last entry it took.
+static int wadfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi) {
+    Wad* wad = getWad();
+    WadHandle handle;
+    handle.index = fi->fh;
+
+    if (offset == 0 && filler(buf, ".", nullptr, 1))
+        return 0;
+    if (offset <= 1 && filler(buf, "..", nullptr, 2))
+        return 0;
+
+    char name[9];
+    int ret = wad->readDirectory(handle, offset <= 2 ? 0 : offset - 2,
+                                 [&](string_view entry, WadHandle, uint64_t next) {
+        memcpy(name, entry.data(), entry.size());
+        name[entry.size()] = '\0';
+        return filler(buf, name, nullptr, next + 2) == 0;
+    });
+    return ret < 0 ? -ENOENT : 0;
+}
+
+// File handles carry the resolved node so each read chunk skips path resolution
+static int wadfs_open(const char *path, struct fuse_file_info *fi) {
+    Wad* wad = getWad();
+    WadHandle handle = wad->resolve(path);
+    if (!handle.isValid())
+        return -ENOENT;
+    if (!wad->isContent(handle))
+        return -EISDIR;
+    fi->fh = handle.index;
+    // Until it is released, flushes for other files leave this one's new data out
+    if ((fi->flags & O_ACCMODE) != O_RDONLY)
+        wad->beginWrite(handle);
+    return 0;
+}
+
+static int wadfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    WadHandle handle;
+    handle.index = fi->fh;
+
+    int ret = getWad()->getContents(handle, buf, size, offset);
+    return ret < 0 ? -EISDIR : ret;
+}
+
+static int wadfs_mknod(const char *path, mode_t mode, dev_t rdev) {
+    Wad* wad = getWad();
+    if (!S_ISREG(mode))
+        return -EPERM;
+    if (wad->resolve(path).isValid())
+        return -EEXIST;
+    if (wad->isReadOnly())
+        return -EROFS;
+
+    wad->createFile(path);
+    return wad->isContent(path) ? 0 : -EINVAL;
+}
+
+// No file handle carries a directory, so a new namespace is written straight away
+static int wadfs_mkdir(const char *path, mode_t mode) {
+    Wad* wad = getWad();
+    if (wad->resolve(path).isValid())
+        return -EEXIST;
+    if (wad->isReadOnly())
+        return -EROFS;
+
+    wad->createDirectory(path);
+    if (!wad->isDirectory(path))
+        return -EINVAL;
+    return wad->flush() ? 0 : -EIO;
+}
+
+// Each request extends the lump, so a file arrives in as many writes as the kernel splits it into,
+// and is committed once, when it is released. After an fsync, the next chunk moves the committed
+// lump to the end of the archive and carries on.
+static int wadfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    Wad* wad = getWad();
+    if (wad->isReadOnly())
+        return -EROFS;
+
+    int ret = wad->writeToFile(path, buf, size, offset);
+    if (ret < 0)
+        return -EISDIR;
+    // The write does not continue where the last one ended, or the archive is full
+    if (ret == 0 && size > 0)
+        return -EPERM;
+    return ret;
+}
+
+static int wadfs_release(const char *path, struct fuse_file_info *fi) {
+    if ((fi->flags & O_ACCMODE) == O_RDONLY)
+        return 0;
+    Wad* wad = getWad();
+    WadHandle handle;
+    handle.index = fi->fh;
+    wad->endWrite(handle);
+    return wad->flush() ? 0 : -EIO;
+}
+
+static int wadfs_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
+    WadHandle handle;
+    handle.index = fi->fh;
+    return getWad()->flush(handle) ? 0 : -EIO;
+}
+
+static void wadfs_destroy(void *privateData) {
+    static_cast<Wad*>(privateData)->flush();
+}
+
+static struct fuse_operations wadfs_ops;
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " [FUSE options] <wadfile> <mountpoint>" << endl;
+        return 1;
+    }
+
+    // The archive is the second-to-last argument; FUSE must not see it
+    string wadPath = argv[argc - 2];
+    if (wadPath[0] != '/') {
+        char cwd[4096];
+        if (getcwd(cwd, sizeof(cwd)))
+            wadPath = string(cwd) + "/" + wadPath;
+    }
+
+    Wad* wad = Wad::loadWad(wadPath);
+    if (!wad->isDirectory("/")) {
+        cerr << "Could not load WAD file: " << wadPath << endl;
+        delete wad;
+        return 1;
+    }
+    wad->beginBatch();
+
+    wadfs_ops.init = wadfs_init;
+    wadfs_ops.getattr = wadfs_getattr;
+    wadfs_ops.opendir = wadfs_opendir;
+    wadfs_ops.readdir = wadfs_readdir;
+    wadfs_ops.open = wadfs_open;
+    wadfs_ops.read = wadfs_read;
+    wadfs_ops.mknod = wadfs_mknod;
+    wadfs_ops.mkdir = wadfs_mkdir;
+    wadfs_ops.write = wadfs_write;
+    wadfs_ops.release = wadfs_release;
+    wadfs_ops.fsync = wadfs_fsync;
+    wadfs_ops.destroy = wadfs_destroy;
+
+    // Forward everything except the archive, and ask for large requests in both directions
+    vector<char*> fuseArgs;
+    for (int i = 0; i < argc; ++i) {
+        if (i != argc - 2)
+            fuseArgs.push_back(argv[i]);
+    }
+    string ioOptions = "-obig_writes,max_read=" + to_string(IO_SIZE) + ",max_write=" + to_string(IO_SIZE);
+    fuseArgs.insert(fuseArgs.begin() + 1, &ioOptions[0]);
+
+    int ret = fuse_main(fuseArgs.size(), fuseArgs.data(), &wadfs_ops, wad);
+    delete wad;
+    return ret;
+}